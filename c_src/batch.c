@@ -167,7 +167,9 @@ h2o_nif_batch_execute(h2o_nif_batch_t *batch, ErlNifEnv *env)
     TRACE_F("h2o_nif_batch_execute:%s:%d\n", __FILE__, __LINE__);
     h2o_nif_batch_req_t *req = batch->req;
     h2o_nif_batch_req_t *ptr = NULL;
-    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL};
+    h2o_nif_ipc_many_t many;
+    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL, .many = &many};
+    (void)h2o_nif_ipc_many_init(&many);
     while (req != NULL) {
         ctx.req = req;
         if (!req->fun->exec(&ctx, env, req->argc, req->argv) || req->fun->done == NULL) {
@@ -184,6 +186,7 @@ h2o_nif_batch_execute(h2o_nif_batch_t *batch, ErlNifEnv *env)
         }
         req = req->next;
     }
+    (void)h2o_nif_ipc_enqueue_many(&many);
     return h2o_nif_batch_resolve(batch, env);
 }
 
@@ -193,7 +196,7 @@ h2o_nif_batch_resolve(h2o_nif_batch_t *batch, ErlNifEnv *env)
     TRACE_F("h2o_nif_batch_resolve:%s:%d\n", __FILE__, __LINE__);
     h2o_nif_batch_req_t *req = batch->req;
     h2o_nif_batch_req_t *ptr = NULL;
-    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL};
+    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL, .many = NULL};
     while (req != NULL) {
         ctx.req = req;
         if (req->fun->done(&ctx, env, req->argc, req->argv)) {
@@ -239,7 +242,7 @@ h2o_nif_batch_match_call(h2o_nif_batch_t *batch, ErlNifEnv *env, ErlNifPid to, E
     int arity;
     const ERL_NIF_TERM *array;
     unsigned int index;
-    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL};
+    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL, .many = NULL};
     if (!enif_get_tuple(env, request, &arity, &array) || arity != 2 || !enif_get_uint(env, array[0], &index) ||
         index >= h2o_nif_batch_call_max || !enif_get_tuple(env, array[1], &arity, &array)) {
         return 0;
@@ -262,7 +265,7 @@ h2o_nif_batch_match_cast(h2o_nif_batch_t *batch, ErlNifEnv *env, ERL_NIF_TERM re
     int arity;
     const ERL_NIF_TERM *array;
     unsigned int index;
-    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL};
+    h2o_nif_batch_ctx_t ctx = {.batch = batch, .req = NULL, .many = NULL};
     if (!enif_get_tuple(env, request, &arity, &array) || arity != 2 || !enif_get_uint(env, array[0], &index) ||
         index >= h2o_nif_batch_cast_max || !enif_get_tuple(env, array[1], &arity, &array)) {
         return 0;
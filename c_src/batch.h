@@ -50,6 +50,7 @@ struct h2o_nif_batch_s {
 struct h2o_nif_batch_ctx_s {
     h2o_nif_batch_t *batch;
     h2o_nif_batch_req_t *req;
+    h2o_nif_ipc_many_t *many; /* IPC messages queued by exec, flushed once per batch */
 };
 
 struct h2o_nif_ipc_batch_req_s {
@@ -128,7 +129,7 @@ h2o_nif_ipc_batch_handler_event(h2o_nif_handler_event_t *handler_event, h2o_nif_
     message->batch = batch;
     message->req = req;
     message->data.handler_event = handler_event;
-    return h2o_nif_ipc_enqueue(ctx->thread->ipc_queue, (h2o_nif_ipc_message_t *)message);
+    return h2o_nif_ipc_enqueue(ctx->thread->loop->ipc_queue, (h2o_nif_ipc_message_t *)message);
 }
 
 #endif
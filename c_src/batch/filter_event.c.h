@@ -221,7 +221,11 @@ filter_event_send_3_exec(h2o_nif_batch_ctx_t *ctx, ErlNifEnv *env, int argc, con
         message->batch = ctx->batch;
         (void)h2o_nif_port_keep(&filter_event->super);
         message->event = filter_event;
-        (void)h2o_nif_ipc_enqueue(thread_ctx->thread->ipc_queue, &message->super);
+        if (ctx->many != NULL) {
+            (void)h2o_nif_ipc_many_add(ctx->many, thread_ctx->thread->loop->ipc_queue, &message->super);
+        } else {
+            (void)h2o_nif_ipc_enqueue(thread_ctx->thread->loop->ipc_queue, &message->super);
+        }
     }
     return 1;
 }
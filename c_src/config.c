@@ -27,6 +27,9 @@
 #include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#ifdef __linux__
+#include <linux/filter.h>
+#endif
 #ifdef __GLIBC__
 #include <execinfo.h>
 #endif
@@ -45,6 +48,7 @@
 #include "filter.h"
 #include "handler.h"
 #include "logger.h"
+#include "slice.h"
 
 #ifdef TCP_FASTOPEN
 #define H2O_DEFAULT_LENGTH_TCP_FASTOPEN_QUEUE 4096
@@ -52,6 +56,8 @@
 #define H2O_DEFAULT_LENGTH_TCP_FASTOPEN_QUEUE 0
 #endif
 
+ErlNifResourceType *h2o_nif_config_terms_resource_type = NULL;
+
 /* Types */
 
 typedef struct h2o_nif_filter_configurator_s h2o_nif_filter_configurator_t;
@@ -99,28 +105,55 @@ static int on_config_erlang_logger(h2o_configurator_command_t *cmd, h2o_configur
 static void on_config_erlang_logger_dispose_handle(void *_lh);
 static int on_config_erlang_logger_enter(h2o_configurator_t *super, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_erlang_logger_exit(h2o_configurator_t *super, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_busy_poll_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_cpu_affinity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_error_log(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_ipc_budget_messages(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_ipc_budget_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_loop_pool(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_loop_watchdog_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_listen_enter(h2o_configurator_t *configurator, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_listen_exit(h2o_configurator_t *configurator, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_max_connections(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_max_connections_wakeups(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_num_name_resolution_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_num_ocsp_updaters(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_num_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_numa_local(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_tcp_fastopen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_ssl_certificate_store(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
+static int on_config_ssl_session_resumption(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 static int on_config_temp_buffer_path(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node);
 
 /* Listeners (Declarations) */
 
 static h2o_nif_cfg_listen_t *add_listener(h2o_nif_config_t *config, int fd, struct sockaddr *addr, socklen_t addrlen, int is_global,
-                                          int proxy_protocol);
+                                          int proxy_protocol, int reuseport);
+static int attach_cpu_steering(h2o_nif_config_t *config, h2o_nif_cfg_listen_t *listener);
+static int create_tcp_listener(h2o_nif_config_t *config, int domain, int type, int protocol, struct sockaddr *addr,
+                               socklen_t addrlen, int reuseport);
 static h2o_nif_cfg_listen_t *find_listener(h2o_nif_config_t *config, struct sockaddr *addr, socklen_t addrlen);
 static int open_tcp_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node, const char *hostname,
-                             const char *servname, int domain, int type, int protocol, struct sockaddr *addr, socklen_t addrlen);
+                             const char *servname, int domain, int type, int protocol, struct sockaddr *addr, socklen_t addrlen,
+                             int reuseport);
+static int listener_setup_ssl(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *listen_node,
+                              yoml_t *ssl_node, h2o_nif_cfg_listen_t *listener, int listener_is_new);
+static int on_sni_callback(SSL *ssl, int *ad, void *arg);
 static int open_unix_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node,
                               struct sockaddr_un *sa);
 static void set_cloexec(int fd);
 
+/* NIF Functions */
+
+int
+h2o_nif_config_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
+{
+    h2o_nif_config_terms_resource_type = enif_open_resource_type(env, NULL, "h2o_nif_config_terms", NULL,
+                                                                 ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+    return 0;
+}
+
 /* Config Functions */
 
 int
@@ -137,9 +170,28 @@ h2o_nif_config_init(h2o_nif_config_t *config)
     config->error_log = NULL;
     config->error_log_fd = -1;
     config->max_connections = 1024;
+    config->max_connections_wakeups = 1;
     config->num_threads = h2o_numproc();
+    config->cpu_affinity = NULL;
+    config->num_cpu_affinity = 0;
+    config->numa_local = 0;
+    config->ipc_budget_messages = 1024;
+    config->ipc_budget_usec = 0;
+    config->loop_watchdog_usec = 0;
+    config->loop_pool = NULL;
+    config->busy_poll_usec = 0;
     config->tfo_queues = H2O_DEFAULT_LENGTH_TCP_FASTOPEN_QUEUE;
+    if (!h2o_nif_ssl_resumption_init(&config->ssl_resumption)) {
+        return 0;
+    }
+    if (!h2o_nif_ssl_store_init(&config->ssl_store, &config->ssl_resumption)) {
+        (void)h2o_nif_ssl_resumption_dispose(&config->ssl_resumption);
+        return 0;
+    }
     config->env = NULL;
+    config->terms.env = NULL;
+    config->terms.hosts = NULL;
+    config->terms.num_hosts = 0;
     /* setup configurators */
     {
         h2o_configurator_t *c = h2o_configurator_create(&config->globalconf, sizeof(*c));
@@ -150,15 +202,43 @@ h2o_nif_config_init(h2o_nif_config_t *config)
     }
     {
         h2o_configurator_t *c = h2o_configurator_create(&config->globalconf, sizeof(*c));
+        (void)h2o_configurator_define_command(c, "busy-poll-usec",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_busy_poll_usec);
+        (void)h2o_configurator_define_command(c, "cpu-affinity",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SEQUENCE,
+                                              on_config_cpu_affinity);
         (void)h2o_configurator_define_command(c, "error-log", H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                               on_config_error_log);
+        (void)h2o_configurator_define_command(c, "ipc-budget-messages",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_ipc_budget_messages);
+        (void)h2o_configurator_define_command(c, "ipc-budget-usec",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_ipc_budget_usec);
+        (void)h2o_configurator_define_command(c, "loop-pool", H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_loop_pool);
+        (void)h2o_configurator_define_command(c, "loop-watchdog-usec",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_loop_watchdog_usec);
         (void)h2o_configurator_define_command(c, "max-connections", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_max_connections);
+        (void)h2o_configurator_define_command(c, "max-connections-wakeups",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_max_connections_wakeups);
         (void)h2o_configurator_define_command(c, "num-name-resolution-threads", H2O_CONFIGURATOR_FLAG_GLOBAL,
                                               on_config_num_name_resolution_threads);
         (void)h2o_configurator_define_command(c, "num-ocsp-updaters",
                                               H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
                                               on_config_num_ocsp_updaters);
         (void)h2o_configurator_define_command(c, "num-threads", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_num_threads);
+        (void)h2o_configurator_define_command(c, "numa-local", H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR,
+                                              on_config_numa_local);
+        (void)h2o_configurator_define_command(c, "ssl-certificate-store",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_MAPPING,
+                                              on_config_ssl_certificate_store);
+        (void)h2o_configurator_define_command(c, "ssl-session-resumption",
+                                              H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_MAPPING,
+                                              on_config_ssl_session_resumption);
         (void)h2o_configurator_define_command(c, "tcp-fastopen", H2O_CONFIGURATOR_FLAG_GLOBAL, on_config_tcp_fastopen);
         (void)h2o_configurator_define_command(
             c, "temp-buffer-path", H2O_CONFIGURATOR_FLAG_GLOBAL | H2O_CONFIGURATOR_FLAG_EXPECT_SCALAR, on_config_temp_buffer_path);
@@ -204,7 +284,23 @@ h2o_nif_config_init(h2o_nif_config_t *config)
 void
 h2o_nif_config_dispose(h2o_nif_config_t *config)
 {
+    size_t i;
     (void)h2o_config_dispose(&config->globalconf);
+    (void)h2o_nif_ssl_store_dispose(&config->ssl_store);
+    (void)h2o_nif_ssl_resumption_dispose(&config->ssl_resumption);
+    for (i = 0; i != config->num_cpu_affinity; ++i) {
+        (void)enif_free(config->cpu_affinity[i].entries);
+    }
+    if (config->cpu_affinity != NULL) {
+        (void)enif_free(config->cpu_affinity);
+    }
+    if (config->terms.hosts != NULL) {
+        (void)enif_free(config->terms.hosts);
+    }
+    if (config->terms.env != NULL) {
+        (void)enif_free_env(config->terms.env);
+    }
+    (void)free(config->loop_pool);
     (void)memset(config, 0, sizeof(*config));
     return;
 }
@@ -213,7 +309,7 @@ int
 h2o_nif_config_get(h2o_nif_config_t *config, ErlNifEnv *env, ERL_NIF_TERM *out)
 {
     assert((env != NULL) && (out != NULL));
-    ERL_NIF_TERM list[7];
+    ERL_NIF_TERM list[17];
     int i = 0;
 
     (void)enif_mutex_lock(h2o_nif_mutex);
@@ -228,6 +324,27 @@ h2o_nif_config_get(h2o_nif_config_t *config, ErlNifEnv *env, ERL_NIF_TERM *out)
 
 #define ERL_NIF_LITBIN(s) ((ErlNifBinary){.size = sizeof(s) - 1, .data = (unsigned char *)(s)})
 
+    /* busy-poll-usec */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("busy-poll-usec");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_uint64(env, config->busy_poll_usec));
+    }
+    /* cpu-affinity */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("cpu-affinity");
+        ERL_NIF_TERM sets = enif_make_list(env, 0);
+        size_t j = config->num_cpu_affinity;
+        while (j-- > 0) {
+            h2o_nif_cfg_cpus_t *cpus = &config->cpu_affinity[j];
+            ERL_NIF_TERM set = enif_make_list(env, 0);
+            size_t k = cpus->size;
+            while (k-- > 0) {
+                set = enif_make_list_cell(env, enif_make_int(env, cpus->entries[k]), set);
+            }
+            sets = enif_make_list_cell(env, set, sets);
+        }
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), sets);
+    }
     /* error-log */
     {
         ErlNifBinary key = ERL_NIF_LITBIN("error-log");
@@ -238,11 +355,41 @@ h2o_nif_config_get(h2o_nif_config_t *config, ErlNifEnv *env, ERL_NIF_TERM *out)
             list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_binary(env, &val));
         }
     }
+    /* ipc-budget-messages */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("ipc-budget-messages");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_ulong(env, config->ipc_budget_messages));
+    }
+    /* ipc-budget-usec */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("ipc-budget-usec");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_uint64(env, config->ipc_budget_usec));
+    }
+    /* loop-pool */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("loop-pool");
+        if (config->loop_pool == NULL) {
+            list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), ATOM_nil);
+        } else {
+            ErlNifBinary val = {strlen(config->loop_pool), (unsigned char *)config->loop_pool};
+            list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_binary(env, &val));
+        }
+    }
+    /* loop-watchdog-usec */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("loop-watchdog-usec");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_uint64(env, config->loop_watchdog_usec));
+    }
     /* max-connections */
     {
         ErlNifBinary key = ERL_NIF_LITBIN("max-connections");
         list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_int(env, config->max_connections));
     }
+    /* max-connections-wakeups */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("max-connections-wakeups");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_ulong(env, config->max_connections_wakeups));
+    }
     /* num-name-resolution-threads */
     {
         ErlNifBinary key = ERL_NIF_LITBIN("num-name-resolution-threads");
@@ -258,6 +405,52 @@ h2o_nif_config_get(h2o_nif_config_t *config, ErlNifEnv *env, ERL_NIF_TERM *out)
         ErlNifBinary key = ERL_NIF_LITBIN("num-threads");
         list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), enif_make_ulong(env, config->num_threads));
     }
+    /* numa-local */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("numa-local");
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), (config->numa_local) ? ATOM_true : ATOM_false);
+    }
+    /* ssl-certificate-store */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("ssl-certificate-store");
+        ErlNifBinary capacity_key = ERL_NIF_LITBIN("capacity");
+        ErlNifBinary certificates_key = ERL_NIF_LITBIN("certificates");
+        ERL_NIF_TERM val = enif_make_list2(
+            env, enif_make_tuple2(env, enif_make_binary(env, &capacity_key), enif_make_ulong(env, config->ssl_store.capacity)),
+            enif_make_tuple2(env, enif_make_binary(env, &certificates_key),
+                             enif_make_ulong(env, atomic_load_explicit(&config->ssl_store.num_certs, memory_order_relaxed))));
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), val);
+    }
+    /* ssl-session-resumption */
+    {
+        ErlNifBinary key = ERL_NIF_LITBIN("ssl-session-resumption");
+        h2o_nif_ssl_resumption_t *resumption = &config->ssl_resumption;
+        ErlNifBinary mode;
+        switch (resumption->mode) {
+        case H2O_NIF_SSL_RESUMPTION_ALL:
+            mode = ERL_NIF_LITBIN("all");
+            break;
+        case H2O_NIF_SSL_RESUMPTION_CACHE:
+            mode = ERL_NIF_LITBIN("cache");
+            break;
+        case H2O_NIF_SSL_RESUMPTION_TICKET:
+            mode = ERL_NIF_LITBIN("ticket");
+            break;
+        default:
+            mode = ERL_NIF_LITBIN("off");
+            break;
+        }
+        ErlNifBinary mode_key = ERL_NIF_LITBIN("mode");
+        ErlNifBinary cache_capacity_key = ERL_NIF_LITBIN("cache-capacity");
+        ErlNifBinary cache_lifetime_key = ERL_NIF_LITBIN("cache-lifetime");
+        ErlNifBinary ticket_lifetime_key = ERL_NIF_LITBIN("ticket-lifetime");
+        ERL_NIF_TERM val = enif_make_list4(
+            env, enif_make_tuple2(env, enif_make_binary(env, &mode_key), enif_make_binary(env, &mode)),
+            enif_make_tuple2(env, enif_make_binary(env, &cache_capacity_key), enif_make_ulong(env, resumption->cache_capacity)),
+            enif_make_tuple2(env, enif_make_binary(env, &cache_lifetime_key), enif_make_uint64(env, resumption->cache_lifetime)),
+            enif_make_tuple2(env, enif_make_binary(env, &ticket_lifetime_key), enif_make_uint64(env, resumption->ticket_lifetime)));
+        list[i++] = enif_make_tuple2(env, enif_make_binary(env, &key), val);
+    }
     /* tcp-fastopen */
     {
         ErlNifBinary key = ERL_NIF_LITBIN("tcp-fastopen");
@@ -311,6 +504,64 @@ h2o_nif_config_set(h2o_nif_config_t *config, ErlNifEnv *env, ErlNifBinary *input
     return 1;
 }
 
+/*
+ * Materializes the request fields that only depend on the host (and the scheme) once, so that building an event copies a
+ * reference to a shared binary instead of allocating a fresh one per request.  The strings live in a single resource that
+ * every resource binary made from it keeps alive.
+ */
+int
+h2o_nif_config_build_terms(h2o_nif_config_t *config)
+{
+    h2o_hostconf_t **hosts = config->globalconf.hosts;
+    size_t num_hosts = 0;
+    size_t size = H2O_URL_SCHEME_HTTP.name.len + H2O_URL_SCHEME_HTTPS.name.len;
+    size_t i;
+    char *data = NULL;
+    char *p = NULL;
+    ErlNifEnv *env = NULL;
+
+    if (config->terms.env != NULL) {
+        return 1;
+    }
+    for (i = 0; hosts != NULL && hosts[i] != NULL; ++i) {
+        size += hosts[i]->authority.host.len;
+        ++num_hosts;
+    }
+    if ((env = enif_alloc_env()) == NULL) {
+        return 0;
+    }
+    if ((data = enif_alloc_resource(h2o_nif_config_terms_resource_type, (size == 0) ? 1 : size)) == NULL) {
+        (void)enif_free_env(env);
+        return 0;
+    }
+    if (num_hosts != 0 && (config->terms.hosts = enif_alloc(sizeof(config->terms.hosts[0]) * num_hosts)) == NULL) {
+        (void)enif_release_resource((void *)data);
+        (void)enif_free_env(env);
+        return 0;
+    }
+    p = data;
+#define make_resource_binary(iov, termp)                                                                                           \
+    do {                                                                                                                           \
+        (void)memcpy(p, (iov).base, (iov).len);                                                                                    \
+        *(termp) = enif_make_resource_binary(env, (void *)data, p, (iov).len);                                                     \
+        p += (iov).len;                                                                                                            \
+    } while (0)
+    make_resource_binary(H2O_URL_SCHEME_HTTP.name, &config->terms.http);
+    make_resource_binary(H2O_URL_SCHEME_HTTPS.name, &config->terms.https);
+    for (i = 0; i != num_hosts; ++i) {
+        h2o_nif_cfg_host_terms_t *terms = &config->terms.hosts[i];
+        terms->hostconf = hosts[i];
+        make_resource_binary(hosts[i]->authority.host, &terms->host);
+        terms->port = enif_make_uint(env, hosts[i]->authority.port);
+    }
+#undef make_resource_binary
+    /* the binaries hold the only references from now on */
+    (void)enif_release_resource((void *)data);
+    config->terms.num_hosts = num_hosts;
+    config->terms.env = env;
+    return 1;
+}
+
 /* Config Commands (Functions) */
 
 static yoml_t *
@@ -694,6 +945,123 @@ on_config_erlang_logger_exit(h2o_configurator_t *super, h2o_configurator_context
 
 /* END: erlang.logger */
 
+static int
+parse_cpu_list(h2o_configurator_command_t *cmd, yoml_t *node, h2o_nif_cfg_cpus_t *cpus)
+{
+    /* accepts a single CPU ("3") or a comma separated list of CPUs and ranges ("0-3,8") */
+    const char *p = node->data.scalar;
+    cpus->entries = NULL;
+    cpus->size = 0;
+    while (*p != '\0') {
+        char *end;
+        unsigned long first;
+        unsigned long last;
+        first = strtoul(p, &end, 10);
+        if (end == p) {
+            goto Error;
+        }
+        last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtoul(p, &end, 10);
+            if (end == p || last < first) {
+                goto Error;
+            }
+            p = end;
+        }
+        if (last >= H2O_NIF_CONFIG_MAX_CPUS) {
+            (void)h2o_configurator_errprintf(cmd, node, "CPU %lu is out of range (must be <%d)", last, H2O_NIF_CONFIG_MAX_CPUS);
+            goto ErrorExit;
+        }
+        cpus->entries = enif_realloc(cpus->entries, sizeof(cpus->entries[0]) * (cpus->size + (last - first) + 1));
+        for (; first <= last; ++first) {
+            cpus->entries[cpus->size++] = (int)first;
+        }
+        if (*p == ',') {
+            ++p;
+        } else if (*p != '\0') {
+            goto Error;
+        }
+    }
+    if (cpus->size == 0) {
+        goto Error;
+    }
+    return 0;
+
+Error:
+    (void)h2o_configurator_errprintf(cmd, node, "cpu set must be a CPU number or a list of CPUs and ranges (e.g. `0-3,8`)");
+ErrorExit:
+    if (cpus->entries != NULL) {
+        (void)enif_free(cpus->entries);
+        cpus->entries = NULL;
+    }
+    cpus->size = 0;
+    return -1;
+}
+
+static int
+on_config_busy_poll_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_busy_poll_usec:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    /* 0 always blocks in epoll */
+    if (h2o_configurator_scanf(cmd, node, "%" SCNu64, &config->busy_poll_usec) != 0) {
+        return -1;
+    }
+    if (config->busy_poll_usec > INT_MAX) {
+        (void)h2o_configurator_errprintf(cmd, node, "busy-poll-usec must be at most %d", INT_MAX);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+on_config_cpu_affinity(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_cpu_affinity:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    h2o_nif_cfg_cpus_t *sets = NULL;
+    size_t num_sets = node->data.sequence.size;
+    size_t i;
+#ifndef __linux__
+    (void)h2o_configurator_errprintf(cmd, node, "`cpu-affinity` is only supported on Linux");
+    return -1;
+#endif
+    if (num_sets == 0) {
+        (void)h2o_configurator_errprintf(cmd, node, "`cpu-affinity` must list at least one cpu set");
+        return -1;
+    }
+    sets = enif_alloc(sizeof(*sets) * num_sets);
+    for (i = 0; i != num_sets; ++i) {
+        yoml_t *t = node->data.sequence.elements[i];
+        if (t->type != YOML_TYPE_SCALAR) {
+            (void)h2o_configurator_errprintf(cmd, t, "cpu set must be a string");
+            goto Error;
+        }
+        if (parse_cpu_list(cmd, t, &sets[i]) != 0) {
+            goto Error;
+        }
+    }
+    /* replace any previous setting */
+    while (config->num_cpu_affinity > 0) {
+        (void)enif_free(config->cpu_affinity[--config->num_cpu_affinity].entries);
+    }
+    if (config->cpu_affinity != NULL) {
+        (void)enif_free(config->cpu_affinity);
+    }
+    config->cpu_affinity = sets;
+    config->num_cpu_affinity = num_sets;
+    return 0;
+
+Error:
+    while (i-- > 0) {
+        (void)enif_free(sets[i].entries);
+    }
+    (void)enif_free(sets);
+    return -1;
+}
+
 static int
 on_config_error_log(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
@@ -717,6 +1085,8 @@ on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ct
     const char *type = "tcp";
     yoml_t *ssl_node = NULL;
     int proxy_protocol = 0;
+    int reuseport = 0;
+    int cpu_steering = 0;
 
     /* fetch servname (and hostname) */
     switch (node->type) {
@@ -764,6 +1134,43 @@ on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ct
                 return -1;
             }
         }
+        if ((t = yoml_get(node, "reuseport")) != NULL) {
+            if (t->type != YOML_TYPE_SCALAR) {
+                (void)h2o_configurator_errprintf(cmd, node, "`reuseport` must be a string");
+                return -1;
+            }
+            if (strcasecmp(t->data.scalar, "ON") == 0) {
+#ifdef SO_REUSEPORT
+                reuseport = 1;
+#else
+                (void)h2o_configurator_errprintf(cmd, t, "`reuseport` is not supported on this platform");
+                return -1;
+#endif
+            } else if (strcasecmp(t->data.scalar, "OFF") == 0) {
+                reuseport = 0;
+            } else {
+                (void)h2o_configurator_errprintf(cmd, node, "value of `reuseport` must be either of: ON,OFF");
+                return -1;
+            }
+        }
+        if ((t = yoml_get(node, "cpu-steering")) != NULL) {
+            if (t->type != YOML_TYPE_SCALAR) {
+                (void)h2o_configurator_errprintf(cmd, node, "`cpu-steering` must be a string");
+                return -1;
+            }
+            if (strcasecmp(t->data.scalar, "ON") == 0) {
+                cpu_steering = 1;
+            } else if (strcasecmp(t->data.scalar, "OFF") == 0) {
+                cpu_steering = 0;
+            } else {
+                (void)h2o_configurator_errprintf(cmd, node, "value of `cpu-steering` must be either of: ON,OFF");
+                return -1;
+            }
+            if (cpu_steering && !reuseport) {
+                (void)h2o_configurator_errprintf(cmd, t, "`cpu-steering` requires `reuseport: ON`");
+                return -1;
+            }
+        }
     } break;
     default:
         (void)h2o_configurator_errprintf(cmd, node,
@@ -774,6 +1181,10 @@ on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ct
     if (strcmp(type, "unix") == 0) {
 
         /* unix socket */
+        if (reuseport) {
+            (void)h2o_configurator_errprintf(cmd, node, "`reuseport` is only supported for tcp listeners");
+            return -1;
+        }
         struct sockaddr_un sa;
         int listener_is_new;
         h2o_nif_cfg_listen_t *listener;
@@ -791,13 +1202,13 @@ on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ct
             int fd = -1;
             if ((fd = open_unix_listener(cmd, ctx, node, &sa)) == -1)
                 return -1;
-            listener = add_listener(config, fd, (struct sockaddr *)&sa, sizeof(sa), ctx->hostconf == NULL, proxy_protocol);
+            listener = add_listener(config, fd, (struct sockaddr *)&sa, sizeof(sa), ctx->hostconf == NULL, proxy_protocol, 0);
             listener_is_new = 1;
         } else if (listener->proxy_protocol != proxy_protocol) {
             goto ProxyConflict;
         }
-        // if (listener_setup_ssl(cmd, ctx, node, ssl_node, listener, listener_is_new) != 0)
-        //  return -1;
+        if (listener_setup_ssl(cmd, ctx, node, ssl_node, listener, listener_is_new) != 0)
+            return -1;
         if (listener->hosts != NULL && ctx->hostconf != NULL)
             (void)h2o_append_to_null_terminated_list((void *)&listener->hosts, ctx->hostconf);
 
@@ -828,20 +1239,24 @@ on_config_listen(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ct
             if (listener == NULL) {
                 int fd = -1;
                 if ((fd = open_tcp_listener(cmd, ctx, node, hostname, servname, ai->ai_family, ai->ai_socktype, ai->ai_protocol,
-                                            ai->ai_addr, ai->ai_addrlen)) == -1) {
+                                            ai->ai_addr, ai->ai_addrlen, reuseport)) == -1) {
                     (void)freeaddrinfo(res);
                     return -1;
                 }
-                listener = add_listener(config, fd, ai->ai_addr, ai->ai_addrlen, ctx->hostconf == NULL, proxy_protocol);
+                listener = add_listener(config, fd, ai->ai_addr, ai->ai_addrlen, ctx->hostconf == NULL, proxy_protocol, reuseport);
+                listener->cpu_steering = cpu_steering;
                 listener_is_new = 1;
             } else if (listener->proxy_protocol != proxy_protocol) {
                 (void)freeaddrinfo(res);
                 goto ProxyConflict;
+            } else if (listener->reuseport != reuseport || listener->cpu_steering != cpu_steering) {
+                (void)freeaddrinfo(res);
+                goto ReuseportConflict;
+            }
+            if (listener_setup_ssl(cmd, ctx, node, ssl_node, listener, listener_is_new) != 0) {
+                (void)freeaddrinfo(res);
+                return -1;
             }
-            // if (listener_setup_ssl(cmd, ctx, node, ssl_node, listener, listener_is_new) != 0) {
-            //  (void) freeaddrinfo(res);
-            //  return -1;
-            // }
             if (listener->hosts != NULL && ctx->hostconf != NULL)
                 (void)h2o_append_to_null_terminated_list((void *)&listener->hosts, ctx->hostconf);
         }
@@ -860,6 +1275,10 @@ ProxyConflict:
     h2o_configurator_errprintf(cmd, node, "`proxy-protocol` cannot be turned %s, already defined as opposite",
                                proxy_protocol ? "on" : "off");
     return -1;
+
+ReuseportConflict:
+    h2o_configurator_errprintf(cmd, node, "`reuseport` or `cpu-steering` differs from the earlier definition of this listener");
+    return -1;
 }
 
 static int
@@ -901,6 +1320,48 @@ on_config_listen_exit(h2o_configurator_t *configurator, h2o_configurator_context
     return 0;
 }
 
+static int
+on_config_ipc_budget_messages(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_ipc_budget_messages:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    /* 0 drains the whole queue on every wakeup */
+    return h2o_configurator_scanf(cmd, node, "%zu", &config->ipc_budget_messages);
+}
+
+static int
+on_config_ipc_budget_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_ipc_budget_usec:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    /* 0 disables the time budget */
+    return h2o_configurator_scanf(cmd, node, "%" SCNu64, &config->ipc_budget_usec);
+}
+
+static int
+on_config_loop_pool(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_loop_pool:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    /* servers naming the same pool share its loop threads, an empty name gives the server loops of its own */
+    (void)free(config->loop_pool);
+    if (node->data.scalar[0] == 0) {
+        config->loop_pool = NULL;
+    } else {
+        config->loop_pool = h2o_strdup(NULL, node->data.scalar, SIZE_MAX).base;
+    }
+    return 0;
+}
+
+static int
+on_config_loop_watchdog_usec(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_loop_watchdog_usec:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    /* 0 disables the watchdog and per-callback timing */
+    return h2o_configurator_scanf(cmd, node, "%" SCNu64, &config->loop_watchdog_usec);
+}
+
 static int
 on_config_max_connections(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
@@ -909,6 +1370,21 @@ on_config_max_connections(h2o_configurator_command_t *cmd, h2o_configurator_cont
     return h2o_configurator_scanf(cmd, node, "%d", &config->max_connections);
 }
 
+static int
+on_config_max_connections_wakeups(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_max_connections_wakeups:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    if (h2o_configurator_scanf(cmd, node, "%zu", &config->max_connections_wakeups) != 0) {
+        return -1;
+    }
+    if (config->max_connections_wakeups == 0) {
+        (void)h2o_configurator_errprintf(cmd, node, "max-connections-wakeups must be >=1");
+        return -1;
+    }
+    return 0;
+}
+
 static int
 on_config_num_name_resolution_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
 {
@@ -957,6 +1433,123 @@ on_config_num_threads(h2o_configurator_command_t *cmd, h2o_configurator_context_
         (void)h2o_configurator_errprintf(cmd, node, "num-threads must be >=1");
         return -1;
     }
+    if (config->num_threads > H2O_NIF_CONFIG_MAX_THREADS) {
+        (void)h2o_configurator_errprintf(cmd, node, "num-threads must be <=%d", H2O_NIF_CONFIG_MAX_THREADS);
+        return -1;
+    }
+    return 0;
+}
+
+static int
+on_config_numa_local(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_numa_local:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    ssize_t on;
+    if ((on = h2o_configurator_get_one_of(cmd, node, "OFF,ON")) == -1) {
+        return -1;
+    }
+    config->numa_local = (int)on;
+    return 0;
+}
+
+static int
+on_config_ssl_certificate_store(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_ssl_certificate_store:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    h2o_nif_ssl_store_t *store = &config->ssl_store;
+    yoml_t *t;
+    size_t i;
+
+    if ((t = yoml_get(node, "capacity")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%zu", &store->capacity) != 0) {
+            return -1;
+        }
+        if (store->capacity == 0) {
+            (void)h2o_configurator_errprintf(cmd, t, "capacity must be >=1");
+            return -1;
+        }
+    }
+    if ((t = yoml_get(node, "certificates")) != NULL) {
+        if (t->type != YOML_TYPE_SEQUENCE) {
+            (void)h2o_configurator_errprintf(cmd, t, "`certificates` must be a sequence");
+            return -1;
+        }
+        for (i = 0; i != t->data.sequence.size; ++i) {
+            yoml_t *entry = t->data.sequence.elements[i];
+            yoml_t *hostname = NULL;
+            yoml_t *certificate_file = NULL;
+            yoml_t *key_file = NULL;
+            if (entry->type != YOML_TYPE_MAPPING || (hostname = yoml_get(entry, "hostname")) == NULL ||
+                (certificate_file = yoml_get(entry, "certificate-file")) == NULL ||
+                (key_file = yoml_get(entry, "key-file")) == NULL || hostname->type != YOML_TYPE_SCALAR ||
+                certificate_file->type != YOML_TYPE_SCALAR || key_file->type != YOML_TYPE_SCALAR) {
+                (void)h2o_configurator_errprintf(cmd, entry, "each certificate must be a mapping with scalar `hostname`, "
+                                                             "`certificate-file` and `key-file`");
+                return -1;
+            }
+            /* only the file names are recorded, certificates are loaded on the first handshake asking for them */
+            if (!h2o_nif_ssl_store_put(store, h2o_iovec_init(hostname->data.scalar, strlen(hostname->data.scalar)), 0,
+                                       h2o_iovec_init(certificate_file->data.scalar, strlen(certificate_file->data.scalar)),
+                                       h2o_iovec_init(key_file->data.scalar, strlen(key_file->data.scalar)))) {
+                (void)h2o_configurator_errprintf(cmd, hostname, "invalid hostname: %s", hostname->data.scalar);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int
+on_config_ssl_session_resumption(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node)
+{
+    TRACE_F("on_config_ssl_session_resumption:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    h2o_nif_ssl_resumption_t *resumption = &config->ssl_resumption;
+    yoml_t *t;
+
+    if ((t = yoml_get(node, "mode")) != NULL) {
+        switch (h2o_configurator_get_one_of(cmd, t, "off,all,cache,ticket")) {
+        case 0:
+            resumption->mode = 0;
+            break;
+        case 1:
+            resumption->mode = H2O_NIF_SSL_RESUMPTION_ALL;
+            break;
+        case 2:
+            resumption->mode = H2O_NIF_SSL_RESUMPTION_CACHE;
+            break;
+        case 3:
+            resumption->mode = H2O_NIF_SSL_RESUMPTION_TICKET;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if ((t = yoml_get(node, "cache-capacity")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%zu", &resumption->cache_capacity) != 0) {
+            return -1;
+        }
+    }
+    if ((t = yoml_get(node, "cache-lifetime")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%" SCNu64, &resumption->cache_lifetime) != 0) {
+            return -1;
+        }
+        if (resumption->cache_lifetime == 0) {
+            (void)h2o_configurator_errprintf(cmd, t, "cache-lifetime must be >=1");
+            return -1;
+        }
+    }
+    if ((t = yoml_get(node, "ticket-lifetime")) != NULL) {
+        if (h2o_configurator_scanf(cmd, t, "%" SCNu64, &resumption->ticket_lifetime) != 0) {
+            return -1;
+        }
+        if (resumption->ticket_lifetime == 0) {
+            (void)h2o_configurator_errprintf(cmd, t, "ticket-lifetime must be >=1");
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -995,8 +1588,172 @@ on_config_temp_buffer_path(h2o_configurator_command_t *cmd, h2o_configurator_con
 
 /* Listeners (Functions) */
 
+int
+h2o_nif_config_open_reuseport_listeners(h2o_nif_config_t *config)
+{
+    size_t i;
+    size_t j;
+    int retval = 1;
+
+    for (i = 0; i != config->num_listeners; ++i) {
+        h2o_nif_cfg_listen_t *listener = config->listeners[i];
+        if (!listener->reuseport || listener->fds != NULL) {
+            continue;
+        }
+        /* sized for the largest thread count so `h2o_nif_config_resize_reuseport_listeners` never moves it under the loops */
+        int *fds = enif_alloc(sizeof(*fds) * H2O_NIF_CONFIG_MAX_THREADS);
+        if (fds == NULL) {
+            /* threads for this listener fall back to sharing dup()'d copies of the first socket */
+            (void)fprintf(stderr, "[warning] failed to allocate SO_REUSEPORT listeners\n");
+            retval = 0;
+            continue;
+        }
+        fds[0] = listener->fd;
+        for (j = 1; j != config->num_threads; ++j) {
+            if ((fds[j] = create_tcp_listener(config, listener->addr.ss_family, SOCK_STREAM, IPPROTO_TCP,
+                                              (struct sockaddr *)&listener->addr, listener->addrlen, 1)) == -1) {
+                break;
+            }
+        }
+        if (j != config->num_threads) {
+            /* threads for this listener fall back to sharing dup()'d copies of the first socket */
+            (void)fprintf(stderr, "[warning] failed to open SO_REUSEPORT listener %zu of %zu:%s\n", j, config->num_threads,
+                          strerror(errno));
+            while (j-- > 1) {
+                (void)close(fds[j]);
+            }
+            (void)enif_free(fds);
+            retval = 0;
+            continue;
+        }
+        listener->fds = fds;
+        if (listener->cpu_steering && !attach_cpu_steering(config, listener)) {
+            (void)fprintf(stderr, "[warning] failed to attach cpu steering program to listener:%s\n", strerror(errno));
+            retval = 0;
+        }
+    }
+
+    return retval;
+}
+
+int
+h2o_nif_config_resize_reuseport_listeners(h2o_nif_config_t *config, size_t old_num_threads)
+{
+    /*
+     * Called once `num_threads` changed on a running server.  Sockets of new threads join the reuseport group behind the existing
+     * ones, so their index in the group is still the thread index.  Retired threads close their own sockets: they all sit above
+     * the new count, and the kernel only moves the last socket of a group into a hole, so the indices below stay as they are.
+     * Either way the steering program is rebuilt for the new count.  Returns 0 with nothing opened if a socket cannot be opened,
+     * the caller then keeps the old count.
+     */
+    size_t i;
+    size_t j;
+
+    for (i = 0; i != config->num_listeners; ++i) {
+        h2o_nif_cfg_listen_t *listener = config->listeners[i];
+        if (listener->fds == NULL) {
+            continue;
+        }
+        for (j = old_num_threads; j < config->num_threads; ++j) {
+            if ((listener->fds[j] = create_tcp_listener(config, listener->addr.ss_family, SOCK_STREAM, IPPROTO_TCP,
+                                                        (struct sockaddr *)&listener->addr, listener->addrlen, 1)) == -1) {
+                break;
+            }
+        }
+        if (j < config->num_threads) {
+            (void)fprintf(stderr, "[warning] failed to open SO_REUSEPORT listener %zu of %zu:%s\n", j, config->num_threads,
+                          strerror(errno));
+            /* close what this call opened on this listener, then on the ones before it */
+            while (j-- > old_num_threads) {
+                (void)close(listener->fds[j]);
+                listener->fds[j] = -1;
+            }
+            while (i-- > 0) {
+                listener = config->listeners[i];
+                if (listener->fds == NULL) {
+                    continue;
+                }
+                for (j = old_num_threads; j < config->num_threads; ++j) {
+                    (void)close(listener->fds[j]);
+                    listener->fds[j] = -1;
+                }
+            }
+            return 0;
+        }
+    }
+    for (i = 0; i != config->num_listeners; ++i) {
+        h2o_nif_cfg_listen_t *listener = config->listeners[i];
+        if (listener->fds != NULL && listener->cpu_steering && !attach_cpu_steering(config, listener)) {
+            /* connections keep being spread by the default reuseport hash */
+            (void)fprintf(stderr, "[warning] failed to attach cpu steering program to listener:%s\n", strerror(errno));
+        }
+    }
+
+    return 1;
+}
+
+static int
+attach_cpu_steering(h2o_nif_config_t *config, h2o_nif_cfg_listen_t *listener)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    /*
+     * The program returns the index of the socket in the reuseport group (the order the sockets were bound in, i.e. the thread
+     * index) for the CPU that handled the incoming packet.  CPUs pinned through `cpu-affinity` map to their thread, all others
+     * fall back to `cpu % num_threads`.
+     */
+    size_t num_insns = 3;
+    size_t i;
+    size_t j;
+    for (i = 0; i != config->num_threads; ++i) {
+        h2o_nif_cfg_cpus_t *cpus = h2o_nif_config_thread_cpus(config, i);
+        if (cpus != NULL) {
+            num_insns += 2 * cpus->size;
+        }
+    }
+    if (num_insns > BPF_MAXINSNS) {
+        errno = E2BIG;
+        return 0;
+    }
+    struct sock_filter *code = enif_alloc(sizeof(*code) * num_insns);
+    size_t n = 0;
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    for (i = 0; i != config->num_threads; ++i) {
+        h2o_nif_cfg_cpus_t *cpus = h2o_nif_config_thread_cpus(config, i);
+        if (cpus == NULL) {
+            continue;
+        }
+        for (j = 0; j != cpus->size; ++j) {
+            code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)cpus->entries[j], 0, 1);
+            code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, (uint32_t)i);
+        }
+    }
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, (uint32_t)config->num_threads);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    struct sock_fprog prog = {.len = (unsigned short)n, .filter = code};
+    int retval = setsockopt(listener->fds[0], SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    (void)enif_free(code);
+    if (retval != 0) {
+        return 0;
+    }
+#ifdef SO_INCOMING_CPU
+    /* older kernels without the program above still prefer the socket whose incoming CPU matches */
+    for (i = 0; i != config->num_threads; ++i) {
+        h2o_nif_cfg_cpus_t *cpus = h2o_nif_config_thread_cpus(config, i);
+        if (cpus != NULL && cpus->size == 1) {
+            (void)setsockopt(listener->fds[i], SOL_SOCKET, SO_INCOMING_CPU, &cpus->entries[0], sizeof(cpus->entries[0]));
+        }
+    }
+#endif
+    return 1;
+#else
+    errno = ENOTSUP;
+    return 0;
+#endif
+}
+
 static h2o_nif_cfg_listen_t *
-add_listener(h2o_nif_config_t *config, int fd, struct sockaddr *addr, socklen_t addrlen, int is_global, int proxy_protocol)
+add_listener(h2o_nif_config_t *config, int fd, struct sockaddr *addr, socklen_t addrlen, int is_global, int proxy_protocol,
+             int reuseport)
 {
     h2o_nif_cfg_listen_t *listener = enif_alloc(sizeof(*listener));
 
@@ -1009,8 +1766,12 @@ add_listener(h2o_nif_config_t *config, int fd, struct sockaddr *addr, socklen_t
         listener->hosts = enif_alloc(sizeof(listener->hosts[0]));
         listener->hosts[0] = NULL;
     }
-    // (void) memset(&listener->ssl, 0, sizeof(listener->ssl));
+    (void)memset(&listener->ssl, 0, sizeof(listener->ssl));
+    listener->ssl_store = NULL;
     listener->proxy_protocol = proxy_protocol;
+    listener->reuseport = reuseport;
+    listener->cpu_steering = 0;
+    listener->fds = NULL;
 
     config->listeners = enif_realloc(config->listeners, sizeof(*(config->listeners)) * (config->num_listeners + 1));
     config->listeners[config->num_listeners++] = listener;
@@ -1033,10 +1794,9 @@ find_listener(h2o_nif_config_t *config, struct sockaddr *addr, socklen_t addrlen
 }
 
 static int
-open_tcp_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node, const char *hostname,
-                  const char *servname, int domain, int type, int protocol, struct sockaddr *addr, socklen_t addrlen)
+create_tcp_listener(h2o_nif_config_t *config, int domain, int type, int protocol, struct sockaddr *addr, socklen_t addrlen,
+                    int reuseport)
 {
-    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
     int fd;
 
     if ((fd = socket(domain, type, protocol)) == -1)
@@ -1047,6 +1807,14 @@ open_tcp_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *c
         if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) != 0)
             goto Error;
     }
+#ifdef SO_REUSEPORT
+    /* set reuseport; every socket bound to the address must set it before bind */
+    if (reuseport) {
+        int flag = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) != 0)
+            goto Error;
+    }
+#endif
 #ifdef TCP_DEFER_ACCEPT
     { /*set TCP_DEFER_ACCEPT */
         int flag = 1;
@@ -1087,13 +1855,213 @@ open_tcp_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *c
     return fd;
 
 Error:
-    if (fd != -1)
+    if (fd != -1) {
+        int saved_errno = errno;
         (void)close(fd);
-    (void)h2o_configurator_errprintf(NULL, node, "failed to listen to port %s:%s: %s", hostname != NULL ? hostname : "ANY",
-                                     servname, strerror(errno));
+        errno = saved_errno;
+    }
     return -1;
 }
 
+static int
+open_tcp_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node, const char *hostname,
+                  const char *servname, int domain, int type, int protocol, struct sockaddr *addr, socklen_t addrlen, int reuseport)
+{
+    h2o_nif_config_t *config = (h2o_nif_config_t *)ctx->globalconf;
+    int fd;
+
+    if ((fd = create_tcp_listener(config, domain, type, protocol, addr, addrlen, reuseport)) == -1) {
+        (void)h2o_configurator_errprintf(NULL, node, "failed to listen to port %s:%s: %s", hostname != NULL ? hostname : "ANY",
+                                         servname, strerror(errno));
+        return -1;
+    }
+
+    return fd;
+}
+
+static int
+listener_setup_ssl(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *listen_node, yoml_t *ssl_node,
+                   h2o_nif_cfg_listen_t *listener, int listener_is_new)
+{
+    SSL_CTX *ssl_ctx = NULL;
+    yoml_t *certificate_file = NULL;
+    yoml_t *key_file = NULL;
+    yoml_t *minimum_version = NULL;
+    yoml_t *cipher_suite = NULL;
+    yoml_t *cipher_preference = NULL;
+    long ssl_options = SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_COMPRESSION;
+    size_t i;
+
+    if (!listener_is_new) {
+        if (listener->ssl.size != 0 && ssl_node == NULL) {
+            (void)h2o_configurator_errprintf(cmd, listen_node, "cannot accept HTTP; already defined to accept HTTPS");
+            return -1;
+        }
+        if (listener->ssl.size == 0 && ssl_node != NULL) {
+            (void)h2o_configurator_errprintf(cmd, ssl_node, "cannot accept HTTPS; already defined to accept HTTP");
+            return -1;
+        }
+    }
+
+    if (ssl_node == NULL) {
+        return 0;
+    }
+    if (ssl_node->type != YOML_TYPE_MAPPING) {
+        (void)h2o_configurator_errprintf(cmd, ssl_node, "`ssl` is not a mapping");
+        return -1;
+    }
+
+    /* parse */
+    for (i = 0; i != ssl_node->data.mapping.size; ++i) {
+        yoml_t *key = ssl_node->data.mapping.elements[i].key;
+        yoml_t *value = ssl_node->data.mapping.elements[i].value;
+        if (key->type != YOML_TYPE_SCALAR) {
+            (void)h2o_configurator_errprintf(cmd, key, "the key must be a scalar");
+            return -1;
+        }
+        if (strcmp(key->data.scalar, "certificate-file") == 0) {
+            certificate_file = value;
+        } else if (strcmp(key->data.scalar, "key-file") == 0) {
+            key_file = value;
+        } else if (strcmp(key->data.scalar, "minimum-version") == 0) {
+            minimum_version = value;
+        } else if (strcmp(key->data.scalar, "cipher-suite") == 0) {
+            cipher_suite = value;
+        } else if (strcmp(key->data.scalar, "cipher-preference") == 0) {
+            cipher_preference = value;
+        } else {
+            (void)h2o_configurator_errprintf(cmd, key, "unknown property: %s", key->data.scalar);
+            return -1;
+        }
+        if (value->type != YOML_TYPE_SCALAR) {
+            (void)h2o_configurator_errprintf(cmd, value, "`%s` must be a string", key->data.scalar);
+            return -1;
+        }
+    }
+    if (certificate_file == NULL) {
+        (void)h2o_configurator_errprintf(cmd, ssl_node, "could not find mandatory property `certificate-file`");
+        return -1;
+    }
+    if (key_file == NULL) {
+        (void)h2o_configurator_errprintf(cmd, ssl_node, "could not find mandatory property `key-file`");
+        return -1;
+    }
+    if (minimum_version != NULL) {
+        switch (h2o_configurator_get_one_of(cmd, minimum_version, "TLSv1,TLSv1.1,TLSv1.2")) {
+        case 0:
+            break;
+        case 1:
+            ssl_options |= SSL_OP_NO_TLSv1;
+            break;
+        case 2:
+            ssl_options |= SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1;
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (cipher_preference != NULL) {
+        switch (h2o_configurator_get_one_of(cmd, cipher_preference, "client,server")) {
+        case 0:
+            break;
+        case 1:
+            ssl_options |= SSL_OP_CIPHER_SERVER_PREFERENCE;
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    /* setup */
+    ssl_ctx = SSL_CTX_new(SSLv23_server_method());
+    if (ssl_ctx == NULL) {
+        (void)h2o_configurator_errprintf(cmd, ssl_node, "failed to create SSL context");
+        return -1;
+    }
+    (void)SSL_CTX_set_options(ssl_ctx, ssl_options);
+    (void)SSL_CTX_set_session_id_context(ssl_ctx, (const unsigned char *)"h2o_nif", sizeof("h2o_nif") - 1);
+    (void)SSL_CTX_set_ecdh_auto(ssl_ctx, 1);
+    if (SSL_CTX_use_certificate_chain_file(ssl_ctx, certificate_file->data.scalar) != 1) {
+        (void)h2o_configurator_errprintf(cmd, certificate_file, "failed to load certificate file:%s",
+                                         certificate_file->data.scalar);
+        (void)ERR_print_errors_fp(stderr);
+        goto Error;
+    }
+    if (SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file->data.scalar, SSL_FILETYPE_PEM) != 1) {
+        (void)h2o_configurator_errprintf(cmd, key_file, "failed to load private key file:%s", key_file->data.scalar);
+        (void)ERR_print_errors_fp(stderr);
+        goto Error;
+    }
+    if (cipher_suite != NULL && SSL_CTX_set_cipher_list(ssl_ctx, cipher_suite->data.scalar) != 1) {
+        (void)h2o_configurator_errprintf(cmd, cipher_suite, "failed to setup SSL cipher suite");
+        (void)ERR_print_errors_fp(stderr);
+        goto Error;
+    }
+    /* setup protocol negotiation methods */
+#if H2O_USE_NPN
+    (void)h2o_ssl_register_npn_protocols(ssl_ctx, h2o_http2_npn_protocols);
+#endif
+#if H2O_USE_ALPN
+    (void)h2o_ssl_register_alpn_protocols(ssl_ctx, h2o_http2_alpn_protocols);
+#endif
+    (void)SSL_CTX_set_tlsext_servername_callback(ssl_ctx, on_sni_callback);
+    (void)SSL_CTX_set_tlsext_servername_arg(ssl_ctx, listener);
+    listener->ssl_store = &((h2o_nif_config_t *)ctx->globalconf)->ssl_store;
+
+    /* add the certificate to the listener */
+    {
+        h2o_nif_cfg_ssl_t *ssl_config = enif_alloc(sizeof(*ssl_config));
+        (void)memset(ssl_config, 0, sizeof(*ssl_config));
+        if (ctx->hostconf != NULL) {
+            (void)h2o_vector_reserve(NULL, &ssl_config->hostnames, 1);
+            ssl_config->hostnames.entries[ssl_config->hostnames.size++] = ctx->hostconf->authority.hostname;
+        }
+        ssl_config->certificate_file = h2o_strdup(NULL, certificate_file->data.scalar, SIZE_MAX).base;
+        ssl_config->ctx = ssl_ctx;
+        (void)h2o_vector_reserve(NULL, &listener->ssl, listener->ssl.size + 1);
+        listener->ssl.entries[listener->ssl.size++] = ssl_config;
+    }
+
+    return 0;
+
+Error:
+    if (ssl_ctx != NULL) {
+        (void)SSL_CTX_free(ssl_ctx);
+    }
+    return -1;
+}
+
+static int
+on_sni_callback(SSL *ssl, int *ad, void *arg)
+{
+    h2o_nif_cfg_listen_t *listener = (h2o_nif_cfg_listen_t *)arg;
+    const char *server_name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    size_t i;
+    size_t j;
+
+    if (server_name != NULL) {
+        size_t server_name_len = strlen(server_name);
+        for (i = 0; i != listener->ssl.size; ++i) {
+            h2o_nif_cfg_ssl_t *ssl_config = listener->ssl.entries[i];
+            for (j = 0; j != ssl_config->hostnames.size; ++j) {
+                if (h2o_lcstris(server_name, server_name_len, ssl_config->hostnames.entries[j].base,
+                                ssl_config->hostnames.entries[j].len)) {
+                    if (SSL_get_SSL_CTX(ssl) != ssl_config->ctx) {
+                        (void)SSL_set_SSL_CTX(ssl, ssl_config->ctx);
+                    }
+                    return SSL_TLSEXT_ERR_OK;
+                }
+            }
+        }
+        if (listener->ssl_store != NULL && h2o_nif_ssl_store_select(listener->ssl_store, ssl, server_name)) {
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+
+    /* fall back to the default certificate */
+    return SSL_TLSEXT_ERR_OK;
+}
+
 static int
 open_unix_listener(h2o_configurator_command_t *cmd, h2o_configurator_context_t *ctx, yoml_t *node, struct sockaddr_un *sa)
 {
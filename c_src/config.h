@@ -6,11 +6,27 @@
 
 #include "globals.h"
 #include "port.h"
+#include "ssl.h"
+
+/* matches CPU_SETSIZE on glibc */
+#define H2O_NIF_CONFIG_MAX_CPUS 1024
+
+/* upper bound of `num-threads`, also the room reserved for the threads added by `server_set_threads/2` */
+#define H2O_NIF_CONFIG_MAX_THREADS 1024
 
 /* Types */
 
 typedef struct h2o_nif_config_s h2o_nif_config_t;
 typedef struct h2o_nif_cfg_listen_s h2o_nif_cfg_listen_t;
+typedef struct h2o_nif_cfg_cpus_s h2o_nif_cfg_cpus_t;
+typedef struct h2o_nif_cfg_ssl_s h2o_nif_cfg_ssl_t;
+typedef struct h2o_nif_cfg_host_terms_s h2o_nif_cfg_host_terms_t;
+
+struct h2o_nif_cfg_ssl_s {
+    H2O_VECTOR(h2o_iovec_t) hostnames; /* hosts served with this certificate, matched against the SNI server name */
+    char *certificate_file;
+    SSL_CTX *ctx;
+};
 
 struct h2o_nif_cfg_listen_s {
     int fd;
@@ -18,6 +34,22 @@ struct h2o_nif_cfg_listen_s {
     socklen_t addrlen;
     h2o_hostconf_t **hosts;
     int proxy_protocol;
+    int reuseport;
+    int cpu_steering; /* steer each connection to the thread pinned to the CPU that received it (requires `reuseport`) */
+    int *fds; /* one SO_REUSEPORT socket per thread when `reuseport` is set (fds[0] == fd), otherwise NULL; -1 once retired */
+    H2O_VECTOR(h2o_nif_cfg_ssl_t *) ssl; /* empty for plain HTTP listeners, the first entry is the default certificate */
+    h2o_nif_ssl_store_t *ssl_store;      /* consulted by SNI when no entry of `ssl` matches */
+};
+
+struct h2o_nif_cfg_cpus_s {
+    int *entries;
+    size_t size;
+};
+
+struct h2o_nif_cfg_host_terms_s {
+    h2o_hostconf_t *hostconf;
+    ERL_NIF_TERM host; /* resource binary, copying it into an event env only bumps a reference count */
+    ERL_NIF_TERM port;
 };
 
 struct h2o_nif_config_s {
@@ -27,16 +59,120 @@ struct h2o_nif_config_s {
     char *error_log;
     int error_log_fd;
     int max_connections;
+    size_t max_connections_wakeups;
     size_t num_threads;
+    h2o_nif_cfg_cpus_t *cpu_affinity; /* CPU sets assigned to the threads round-robin, NULL when unpinned */
+    size_t num_cpu_affinity;
+    int numa_local;
+    size_t ipc_budget_messages;
+    uint64_t ipc_budget_usec;
+    uint64_t loop_watchdog_usec;
+    char *loop_pool; /* name of the loop threads shared with other servers, NULL for loops of its own */
+    uint64_t busy_poll_usec;
     int tfo_queues;
+    h2o_nif_ssl_resumption_t ssl_resumption;
+    h2o_nif_ssl_store_t ssl_store;
     ErlNifEnv *env;
+    struct {
+        ErlNifEnv *env; /* outlives every event built from these terms */
+        h2o_nif_cfg_host_terms_t *hosts;
+        size_t num_hosts;
+        ERL_NIF_TERM http;
+        ERL_NIF_TERM https;
+    } terms;
 };
 
+/* Variables */
+
+extern ErlNifResourceType *h2o_nif_config_terms_resource_type;
+
+/* NIF Functions */
+
+extern int h2o_nif_config_load(ErlNifEnv *env, h2o_nif_data_t *nif_data);
+
 /* Config Functions */
 
 extern int h2o_nif_config_init(h2o_nif_config_t *config);
 extern void h2o_nif_config_dispose(h2o_nif_config_t *config);
 extern int h2o_nif_config_get(h2o_nif_config_t *config, ErlNifEnv *env, ERL_NIF_TERM *out);
 extern int h2o_nif_config_set(h2o_nif_config_t *config, ErlNifEnv *env, ErlNifBinary *input, ERL_NIF_TERM *out);
+extern int h2o_nif_config_open_reuseport_listeners(h2o_nif_config_t *config);
+extern int h2o_nif_config_resize_reuseport_listeners(h2o_nif_config_t *config, size_t old_num_threads);
+extern int h2o_nif_config_build_terms(h2o_nif_config_t *config);
+
+static h2o_nif_cfg_cpus_t *h2o_nif_config_thread_cpus(h2o_nif_config_t *config, size_t idx);
+static h2o_nif_config_t *h2o_nif_config_from_req(h2o_req_t *req);
+static ERL_NIF_TERM h2o_nif_config_make_host(ErlNifEnv *env, h2o_req_t *req);
+static ERL_NIF_TERM h2o_nif_config_make_port(ErlNifEnv *env, h2o_req_t *req);
+static ERL_NIF_TERM h2o_nif_config_make_scheme(ErlNifEnv *env, h2o_req_t *req);
+static const h2o_nif_cfg_host_terms_t *h2o_nif_config_host_terms(h2o_nif_config_t *config, h2o_hostconf_t *hostconf);
+
+inline h2o_nif_cfg_cpus_t *
+h2o_nif_config_thread_cpus(h2o_nif_config_t *config, size_t idx)
+{
+    if (config->num_cpu_affinity == 0) {
+        return NULL;
+    }
+    return &config->cpu_affinity[idx % config->num_cpu_affinity];
+}
+
+inline h2o_nif_config_t *
+h2o_nif_config_from_req(h2o_req_t *req)
+{
+    return H2O_STRUCT_FROM_MEMBER(h2o_nif_config_t, globalconf, req->conn->ctx->globalconf);
+}
+
+inline const h2o_nif_cfg_host_terms_t *
+h2o_nif_config_host_terms(h2o_nif_config_t *config, h2o_hostconf_t *hostconf)
+{
+    /* a handful of hosts at most, a linear scan beats hashing */
+    size_t i;
+    for (i = 0; i != config->terms.num_hosts; ++i) {
+        if (config->terms.hosts[i].hostconf == hostconf) {
+            return &config->terms.hosts[i];
+        }
+    }
+    return NULL;
+}
+
+inline ERL_NIF_TERM
+h2o_nif_config_make_host(ErlNifEnv *env, h2o_req_t *req)
+{
+    const h2o_nif_cfg_host_terms_t *terms = h2o_nif_config_host_terms(h2o_nif_config_from_req(req), req->hostconf);
+    if (terms != NULL) {
+        return enif_make_copy(env, terms->host);
+    }
+    ERL_NIF_TERM out;
+    unsigned char *buf = enif_make_new_binary(env, req->hostconf->authority.host.len, &out);
+    (void)memcpy(buf, req->hostconf->authority.host.base, req->hostconf->authority.host.len);
+    return out;
+}
+
+inline ERL_NIF_TERM
+h2o_nif_config_make_port(ErlNifEnv *env, h2o_req_t *req)
+{
+    const h2o_nif_cfg_host_terms_t *terms = h2o_nif_config_host_terms(h2o_nif_config_from_req(req), req->hostconf);
+    if (terms != NULL) {
+        return terms->port;
+    }
+    return enif_make_uint(env, req->hostconf->authority.port);
+}
+
+inline ERL_NIF_TERM
+h2o_nif_config_make_scheme(ErlNifEnv *env, h2o_req_t *req)
+{
+    h2o_nif_config_t *config = h2o_nif_config_from_req(req);
+    if (config->terms.env != NULL) {
+        if (req->scheme == &H2O_URL_SCHEME_HTTP) {
+            return enif_make_copy(env, config->terms.http);
+        } else if (req->scheme == &H2O_URL_SCHEME_HTTPS) {
+            return enif_make_copy(env, config->terms.https);
+        }
+    }
+    ERL_NIF_TERM out;
+    unsigned char *buf = enif_make_new_binary(env, req->scheme->name.len, &out);
+    (void)memcpy(buf, req->scheme->name.base, req->scheme->name.len);
+    return out;
+}
 
 #endif
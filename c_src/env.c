@@ -0,0 +1,58 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#include "env.h"
+
+/* pool of the loop thread running on this thread, NULL elsewhere */
+static _Thread_local h2o_nif_env_pool_t *env_thread_pool = NULL;
+
+/* Pool Functions */
+
+void
+h2o_nif_env_pool_init(h2o_nif_env_pool_t *pool)
+{
+    pool->num_free = 0;
+    return;
+}
+
+void
+h2o_nif_env_pool_dispose(h2o_nif_env_pool_t *pool)
+{
+    while (pool->num_free > 0) {
+        (void)enif_free_env(pool->free[--pool->num_free]);
+    }
+    return;
+}
+
+void
+h2o_nif_env_pool_set_thread(h2o_nif_env_pool_t *pool)
+{
+    env_thread_pool = pool;
+    return;
+}
+
+/* Env Functions */
+
+ErlNifEnv *
+h2o_nif_env_acquire(void)
+{
+    h2o_nif_env_pool_t *pool = env_thread_pool;
+    if (pool != NULL && pool->num_free > 0) {
+        return pool->free[--pool->num_free];
+    }
+    return enif_alloc_env();
+}
+
+void
+h2o_nif_env_release(ErlNifEnv *env)
+{
+    h2o_nif_env_pool_t *pool = env_thread_pool;
+    if (pool != NULL && pool->num_free < H2O_NIF_ENV_POOL_SIZE) {
+        /* also required after a successful enif_send(), which invalidates the terms of the environment */
+        (void)enif_clear_env(env);
+        pool->free[pool->num_free++] = env;
+        return;
+    }
+    (void)enif_free_env(env);
+    return;
+}
@@ -0,0 +1,35 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#ifndef H2O_NIF_ENV_H
+#define H2O_NIF_ENV_H
+
+#include "globals.h"
+
+/* Number of cleared environments kept by each loop thread. */
+#define H2O_NIF_ENV_POOL_SIZE 8
+
+typedef struct h2o_nif_env_pool_s h2o_nif_env_pool_t;
+
+/*
+ * Process independent environments used by a loop thread to send messages outside of any NIF call.  They are cleared with
+ * enif_clear_env() when given back, so `enif_alloc_env()` only runs when more environments are in use at once than the pool
+ * keeps.  Only the owning loop thread touches the pool; other threads fall back to allocating an environment per message.
+ */
+struct h2o_nif_env_pool_s {
+    size_t num_free;
+    ErlNifEnv *free[H2O_NIF_ENV_POOL_SIZE];
+};
+
+/* Pool Functions */
+
+extern void h2o_nif_env_pool_init(h2o_nif_env_pool_t *pool);
+extern void h2o_nif_env_pool_dispose(h2o_nif_env_pool_t *pool);
+extern void h2o_nif_env_pool_set_thread(h2o_nif_env_pool_t *pool);
+
+/* Env Functions */
+
+extern ErlNifEnv *h2o_nif_env_acquire(void);
+extern void h2o_nif_env_release(ErlNifEnv *env);
+
+#endif
@@ -10,23 +10,10 @@
 #include <h2o/http2_internal.h>
 #include <h2o/serverutil.h>
 
-/* Types */
-
-typedef struct h2o_nif_filter_deferred_action_s h2o_nif_filter_deferred_action_t;
-
-struct h2o_nif_filter_deferred_action_s {
-    h2o_timeout_entry_t timeout;
-    h2o_nif_filter_t *filter;
-    h2o_req_t *req;
-};
-
 static void on_context_init(h2o_filter_t *super, h2o_context_t *context);
 static void on_context_dispose(h2o_filter_t *super, h2o_context_t *context);
 static void on_dispose(h2o_filter_t *super);
 static void on_setup_ostream(h2o_filter_t *super, h2o_req_t *req, h2o_ostream_t **slot);
-static h2o_nif_filter_deferred_action_t *create_deferred_action(h2o_nif_filter_t *filter, h2o_req_t *req, h2o_timeout_cb cb);
-static void on_deferred_action_dispose(void *_action);
-static void on_ready_input_cb(h2o_timeout_entry_t *entry);
 
 /* Port Functions */
 
@@ -39,12 +26,11 @@ h2o_nif_filter_open(h2o_nif_server_t *server, h2o_pathconf_t *pathconf, h2o_nif_
 {
     assert(filterp != NULL);
     h2o_nif_filter_t *filter = NULL;
-    if (!h2o_nif_port_open(&server->super, sizeof(h2o_nif_filter_t), (h2o_nif_port_t **)&filter)) {
+    if (!h2o_nif_port_open(&server->super, H2O_NIF_PORT_TYPE_FILTER, sizeof(h2o_nif_filter_t), (h2o_nif_port_t **)&filter)) {
         *filterp = NULL;
         return 0;
     }
     filter->super.dtor = h2o_nif_filter_dtor;
-    filter->super.type = H2O_NIF_PORT_TYPE_FILTER;
     (void)atomic_init(&filter->ctx, (uintptr_t)NULL);
     filter->state = (atomic_flag)ATOMIC_FLAG_INIT;
     (void)ck_spinlock_init(&filter->spinlock);
@@ -94,7 +80,9 @@ h2o_nif_filter_dtor(ErlNifEnv *env, h2o_nif_port_t *port)
 {
     TRACE_F("h2o_nif_filter_dtor:%s:%d\n", __FILE__, __LINE__);
     assert(port->type == H2O_NIF_PORT_TYPE_FILTER);
-    // h2o_nif_filter_t *filter = (h2o_nif_filter_t *)port;
+    h2o_nif_filter_t *filter = (h2o_nif_filter_t *)port;
+    /* events nobody read are no longer queued anywhere */
+    (void)h2o_nif_port_stats_dequeued(port, atomic_load_explicit(&filter->num_events, memory_order_relaxed));
     return;
 }
 
@@ -167,53 +155,15 @@ on_setup_ostream(h2o_filter_t *super, h2o_req_t *req, h2o_ostream_t **slot)
             abort();
         }
         (void)atomic_fetch_add_explicit(&filter->num_events, 1, memory_order_relaxed);
+        (void)h2o_nif_port_stats_enqueued(&filter->super, 1);
         (void)ck_spinlock_lock_eb(&filter->spinlock);
         (void)h2o_linklist_insert(&filter->events, &event->_link);
         (void)ck_spinlock_unlock(&filter->spinlock);
     }
     if (!atomic_flag_test_and_set_explicit(&filter->state, memory_order_relaxed)) {
-        (void)create_deferred_action(filter, req, on_ready_input_cb);
+        (void)h2o_nif_server_ready_input(req->conn->ctx, &filter->super, &filter->state);
     }
 
     return;
 }
 
-static h2o_nif_filter_deferred_action_t *
-create_deferred_action(h2o_nif_filter_t *filter, h2o_req_t *req, h2o_timeout_cb cb)
-{
-    TRACE_F("create_deferred_action:%s:%d\n", __FILE__, __LINE__);
-    h2o_nif_filter_deferred_action_t *action = h2o_mem_alloc_shared(&req->pool, sizeof(*action), on_deferred_action_dispose);
-    *action = (h2o_nif_filter_deferred_action_t){{0, cb}, filter, req};
-    (void)h2o_timeout_link(req->conn->ctx->loop, &req->conn->ctx->zero_timeout, &action->timeout);
-    return action;
-}
-
-static void
-on_deferred_action_dispose(void *_action)
-{
-    TRACE_F("on_deferred_action_dispose:%s:%d\n", __FILE__, __LINE__);
-    h2o_nif_filter_deferred_action_t *action = _action;
-    if (h2o_timeout_is_linked(&action->timeout)) {
-        (void)h2o_timeout_unlink(&action->timeout);
-    }
-}
-
-static void
-on_ready_input_cb(h2o_timeout_entry_t *entry)
-{
-    TRACE_F("on_ready_input_cb:%s:%d\n", __FILE__, __LINE__);
-    h2o_nif_filter_deferred_action_t *action = H2O_STRUCT_FROM_MEMBER(h2o_nif_filter_deferred_action_t, timeout, entry);
-    h2o_nif_filter_t *filter = action->filter;
-    // h2o_nif_filter_ctx_t *ctx = (h2o_nif_filter_ctx_t *)atomic_load_explicit(&filter->ctx, memory_order_relaxed);
-    // h2o_req_t *req = action->req;
-    // h2o_nif_filter_data_t *filter_data = h2o_context_get_filter_context(req->conn->ctx, &ctx->super);
-    // ErlNifEnv *env = filter_data->env;
-    ErlNifEnv *env = enif_alloc_env();
-    ERL_NIF_TERM msg;
-    msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &filter->super), ATOM_ready_input);
-    if (!h2o_nif_port_send(NULL, &filter->super, NULL, msg)) {
-        (void)atomic_flag_clear_explicit(&filter->state, memory_order_relaxed);
-    }
-    // (void)enif_clear_env(env);
-    (void)enif_free_env(env);
-}
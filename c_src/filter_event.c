@@ -87,8 +87,7 @@ h2o_nif_filter_event_make(ErlNifEnv *env, h2o_nif_filter_event_t *event)
         tuple[i++] = tmp;
     }
     /* host */
-    h2o_iovec_to_binary(req->hostconf->authority.host, &tmp);
-    tuple[i++] = tmp;
+    tuple[i++] = h2o_nif_config_make_host(env, req);
     /* method */
     h2o_iovec_to_binary(req->method, &tmp);
     tuple[i++] = tmp;
@@ -114,7 +113,7 @@ h2o_nif_filter_event_make(ErlNifEnv *env, h2o_nif_filter_event_t *event)
         tuple[i++] = peer;
     }
     /* port */
-    tuple[i++] = enif_make_uint(env, req->hostconf->authority.port);
+    tuple[i++] = h2o_nif_config_make_port(env, req);
     /* res */
     {
         ERL_NIF_TERM stuple[5];
@@ -159,8 +158,7 @@ h2o_nif_filter_event_make(ErlNifEnv *env, h2o_nif_filter_event_t *event)
     /* resp_headers */
     tuple[i++] = ATOM_undefined;
     /* scheme */
-    h2o_iovec_to_binary(req->scheme->name, &tmp);
-    tuple[i++] = tmp;
+    tuple[i++] = h2o_nif_config_make_scheme(env, req);
     /* send_state */
     tuple[i++] = ATOM_in_progress;
     /* streamid */
@@ -184,12 +182,12 @@ h2o_nif_filter_event_open(h2o_nif_filter_t *filter, h2o_req_t *req, h2o_ostream_
     TRACE_F("h2o_nif_filter_event_open:%s:%d\n", __FILE__, __LINE__);
     assert(eventp != NULL);
     h2o_nif_filter_event_t *event = NULL;
-    if (!h2o_nif_port_open(&filter->super, sizeof(h2o_nif_filter_event_t), (h2o_nif_port_t **)&event)) {
+    if (!h2o_nif_port_open(&filter->super, H2O_NIF_PORT_TYPE_FILTER_EVENT, sizeof(h2o_nif_filter_event_t),
+                           (h2o_nif_port_t **)&event)) {
         *eventp = NULL;
         return 0;
     }
     event->super.dtor = h2o_nif_filter_event_dtor;
-    event->super.type = H2O_NIF_PORT_TYPE_FILTER_EVENT;
     event->_link.prev = event->_link.next = NULL;
     event->req = req;
     (void)atomic_init(&event->entity_offset, 0);
@@ -379,18 +377,20 @@ on_ready_input_cb(h2o_timeout_entry_t *entry)
     h2o_req_t *req = action->req;
     // h2o_nif_filter_data_t *filter_data = h2o_context_get_filter_context(req->conn->ctx, &ctx->super);
     // ErlNifEnv *env = filter_data->env;
-    ErlNifEnv *env = enif_alloc_env();
+    ErlNifEnv *env = h2o_nif_env_acquire();
     ERL_NIF_TERM msg;
+    /* each message is sent with `env` as its own environment and the environment cleared for the next one */
     msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &event->super), ATOM_ready_input);
-    if (!h2o_nif_port_send(NULL, &event->super, NULL, msg)) {
+    if (!h2o_nif_port_send(NULL, &event->super, env, msg)) {
         (void)atomic_flag_clear_explicit(&event->state.ready_input, memory_order_relaxed);
     }
+    (void)enif_clear_env(env);
     (void)send_em(env, event);
     if (event->state.input_state == H2O_SEND_STATE_FINAL) {
         msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &event->super), ATOM_final_input);
-        (void)h2o_nif_port_send(NULL, &event->super, NULL, msg);
+        (void)h2o_nif_port_send(NULL, &event->super, env, msg);
     }
-    (void)enif_free_env(env);
+    (void)h2o_nif_env_release(env);
     (void)h2o_nif_port_release(&event->super);
 }
 
@@ -430,7 +430,7 @@ send_em(ErlNifEnv *env, h2o_nif_filter_event_t *filter_event)
     }
     (void)atomic_fetch_sub_explicit(&filter_event->state.num_input, count, memory_order_relaxed);
     msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &filter_event->super), list);
-    int retval = h2o_nif_port_send(NULL, &filter_event->super, NULL, msg);
+    int retval = h2o_nif_port_send(NULL, &filter_event->super, env, msg);
     (void)enif_clear_env(env);
     return retval;
 }
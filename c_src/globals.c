@@ -1,8 +1,13 @@
 // -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
 // vim: ts=4 sw=4 ft=c et
 
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+
 #include "globals.h"
 #include "batch.h"
+#include "config.h"
 #include "port.h"
 #include "slice.h"
 
@@ -21,22 +26,32 @@ ERL_NIF_TERM ATOM_$gen_cast;
 ERL_NIF_TERM ATOM_accept;
 ERL_NIF_TERM ATOM_active;
 ERL_NIF_TERM ATOM_already_started;
+ERL_NIF_TERM ATOM_at;
 ERL_NIF_TERM ATOM_avg;
 ERL_NIF_TERM ATOM_badcfg;
+ERL_NIF_TERM ATOM_buckets;
+ERL_NIF_TERM ATOM_budget_exhausted;
+ERL_NIF_TERM ATOM_busy;
+ERL_NIF_TERM ATOM_callback;
+ERL_NIF_TERM ATOM_callback_usec;
 ERL_NIF_TERM ATOM_children;
 ERL_NIF_TERM ATOM_closed;
 ERL_NIF_TERM ATOM_configured;
 ERL_NIF_TERM ATOM_connected;
 ERL_NIF_TERM ATOM_continue;
+ERL_NIF_TERM ATOM_count;
 ERL_NIF_TERM ATOM_eagain;
 ERL_NIF_TERM ATOM_entity;
 ERL_NIF_TERM ATOM_error;
 ERL_NIF_TERM ATOM_false;
+ERL_NIF_TERM ATOM_file;
 ERL_NIF_TERM ATOM_filter;
+ERL_NIF_TERM ATOM_filter_event;
 ERL_NIF_TERM ATOM_fin;
 ERL_NIF_TERM ATOM_final_input;
 ERL_NIF_TERM ATOM_finalize;
 ERL_NIF_TERM ATOM_finalized;
+ERL_NIF_TERM ATOM_full_handshakes;
 ERL_NIF_TERM ATOM_gc_avg;
 ERL_NIF_TERM ATOM_gc_max;
 ERL_NIF_TERM ATOM_gc_min;
@@ -44,8 +59,11 @@ ERL_NIF_TERM ATOM_h2o_handler;
 ERL_NIF_TERM ATOM_h2o_port;
 ERL_NIF_TERM ATOM_h2o_port_closed;
 ERL_NIF_TERM ATOM_h2o_port_data;
+ERL_NIF_TERM ATOM_h2o_ports_data;
 ERL_NIF_TERM ATOM_h2o_req;
 ERL_NIF_TERM ATOM_h2o_res;
+ERL_NIF_TERM ATOM_handler;
+ERL_NIF_TERM ATOM_handler_event;
 ERL_NIF_TERM ATOM_handler_event_read_body;
 ERL_NIF_TERM ATOM_handler_event_reply;
 ERL_NIF_TERM ATOM_handler_event_stream_body;
@@ -55,14 +73,24 @@ ERL_NIF_TERM ATOM_HTTP_1_0;
 ERL_NIF_TERM ATOM_HTTP_1_1;
 ERL_NIF_TERM ATOM_HTTP_2;
 ERL_NIF_TERM ATOM_in_progress;
+ERL_NIF_TERM ATOM_ipc;
+ERL_NIF_TERM ATOM_ipc_drain;
+ERL_NIF_TERM ATOM_leaked;
 ERL_NIF_TERM ATOM_listening;
+ERL_NIF_TERM ATOM_live;
+ERL_NIF_TERM ATOM_logger;
+ERL_NIF_TERM ATOM_loop;
+ERL_NIF_TERM ATOM_loop_pool;
 ERL_NIF_TERM ATOM_max;
+ERL_NIF_TERM ATOM_max_drained;
 ERL_NIF_TERM ATOM_mem_info;
+ERL_NIF_TERM ATOM_messages_drained;
 ERL_NIF_TERM ATOM_min;
 ERL_NIF_TERM ATOM_more;
 ERL_NIF_TERM ATOM_n_buckets;
 ERL_NIF_TERM ATOM_nil;
 ERL_NIF_TERM ATOM_nofin;
+ERL_NIF_TERM ATOM_not_started;
 ERL_NIF_TERM ATOM_num_accept;
 ERL_NIF_TERM ATOM_num_children;
 ERL_NIF_TERM ATOM_num_listen;
@@ -71,22 +99,41 @@ ERL_NIF_TERM ATOM_num_ports;
 ERL_NIF_TERM ATOM_ok;
 ERL_NIF_TERM ATOM_once;
 ERL_NIF_TERM ATOM_open;
+ERL_NIF_TERM ATOM_opened;
+ERL_NIF_TERM ATOM_p50;
+ERL_NIF_TERM ATOM_p90;
+ERL_NIF_TERM ATOM_p99;
+ERL_NIF_TERM ATOM_p999;
 ERL_NIF_TERM ATOM_parent;
+ERL_NIF_TERM ATOM_pass;
+ERL_NIF_TERM ATOM_pass_usec;
 ERL_NIF_TERM ATOM_port_connect;
 ERL_NIF_TERM ATOM_ports_stat;
+ERL_NIF_TERM ATOM_queued;
 ERL_NIF_TERM ATOM_ready_input;
 ERL_NIF_TERM ATOM_reply;
+ERL_NIF_TERM ATOM_request;
 ERL_NIF_TERM ATOM_requested;
+ERL_NIF_TERM ATOM_resumptions;
+ERL_NIF_TERM ATOM_reuseport;
 ERL_NIF_TERM ATOM_send_data;
 ERL_NIF_TERM ATOM_seq;
 ERL_NIF_TERM ATOM_seq_ports;
+ERL_NIF_TERM ATOM_server;
 ERL_NIF_TERM ATOM_size;
+ERL_NIF_TERM ATOM_ssl;
 ERL_NIF_TERM ATOM_started;
 ERL_NIF_TERM ATOM_state;
+ERL_NIF_TERM ATOM_sum;
+ERL_NIF_TERM ATOM_ticket_resumptions;
 ERL_NIF_TERM ATOM_trap;
 ERL_NIF_TERM ATOM_true;
 ERL_NIF_TERM ATOM_type;
 ERL_NIF_TERM ATOM_undefined;
+ERL_NIF_TERM ATOM_wakeups_received;
+ERL_NIF_TERM ATOM_wakeups_sent;
+ERL_NIF_TERM ATOM_wakeups_suppressed;
+ERL_NIF_TERM ATOM_watchdog;
 
 /* NIF Functions */
 
@@ -105,7 +152,17 @@ h2o_nif_globals_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
         (void)h2o_nif_batch_unload(env, nif_data);
         return -1;
     }
+    if (h2o_nif_config_load(env, nif_data) != 0) {
+        (void)h2o_nif_slice_unload(env, nif_data);
+        (void)h2o_nif_port_unload(env, nif_data);
+        (void)h2o_nif_batch_unload(env, nif_data);
+        return -1;
+    }
     h2o_srand();
+    /* required before any TLS listener is configured */
+    (void)SSL_load_error_strings();
+    (void)SSL_library_init();
+    (void)OpenSSL_add_all_algorithms();
     h2o_hostinfo_max_threads = H2O_DEFAULT_NUM_NAME_RESOLUTION_THREADS;
     (void)h2o_sem_init(&h2o_ocsp_updater_semaphore, H2O_DEFAULT_OCSP_UPDATER_MAX_THREADS);
 
@@ -119,22 +176,32 @@ h2o_nif_globals_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
     ATOM(ATOM_accept, "accept");
     ATOM(ATOM_active, "active");
     ATOM(ATOM_already_started, "already_started");
+    ATOM(ATOM_at, "at");
     ATOM(ATOM_avg, "avg");
     ATOM(ATOM_badcfg, "badcfg");
+    ATOM(ATOM_buckets, "buckets");
+    ATOM(ATOM_budget_exhausted, "budget_exhausted");
+    ATOM(ATOM_busy, "busy");
+    ATOM(ATOM_callback, "callback");
+    ATOM(ATOM_callback_usec, "callback_usec");
     ATOM(ATOM_children, "children");
     ATOM(ATOM_closed, "closed");
     ATOM(ATOM_configured, "configured");
     ATOM(ATOM_connected, "connected");
     ATOM(ATOM_continue, "continue");
+    ATOM(ATOM_count, "count");
     ATOM(ATOM_eagain, "eagain");
     ATOM(ATOM_entity, "entity");
     ATOM(ATOM_error, "error");
     ATOM(ATOM_false, "false");
+    ATOM(ATOM_file, "file");
     ATOM(ATOM_filter, "filter");
+    ATOM(ATOM_filter_event, "filter_event");
     ATOM(ATOM_fin, "fin");
     ATOM(ATOM_final_input, "final_input");
     ATOM(ATOM_finalize, "finalize");
     ATOM(ATOM_finalized, "finalized");
+    ATOM(ATOM_full_handshakes, "full_handshakes");
     ATOM(ATOM_gc_avg, "gc_avg");
     ATOM(ATOM_gc_max, "gc_max");
     ATOM(ATOM_gc_min, "gc_min");
@@ -142,8 +209,11 @@ h2o_nif_globals_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
     ATOM(ATOM_h2o_port, "h2o_port");
     ATOM(ATOM_h2o_port_closed, "h2o_port_closed");
     ATOM(ATOM_h2o_port_data, "h2o_port_data");
+    ATOM(ATOM_h2o_ports_data, "h2o_ports_data");
     ATOM(ATOM_h2o_req, "h2o_req");
     ATOM(ATOM_h2o_res, "h2o_res");
+    ATOM(ATOM_handler, "handler");
+    ATOM(ATOM_handler_event, "handler_event");
     ATOM(ATOM_handler_event_read_body, "handler_event_read_body");
     ATOM(ATOM_handler_event_reply, "handler_event_reply");
     ATOM(ATOM_handler_event_stream_body, "handler_event_stream_body");
@@ -153,14 +223,24 @@ h2o_nif_globals_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
     ATOM(ATOM_HTTP_1_1, "HTTP/1.1");
     ATOM(ATOM_HTTP_2, "HTTP/2");
     ATOM(ATOM_in_progress, "in_progress");
+    ATOM(ATOM_ipc, "ipc");
+    ATOM(ATOM_ipc_drain, "ipc_drain");
+    ATOM(ATOM_leaked, "leaked");
     ATOM(ATOM_listening, "listening");
+    ATOM(ATOM_live, "live");
+    ATOM(ATOM_logger, "logger");
+    ATOM(ATOM_loop, "loop");
+    ATOM(ATOM_loop_pool, "loop_pool");
     ATOM(ATOM_max, "max");
+    ATOM(ATOM_max_drained, "max_drained");
     ATOM(ATOM_mem_info, "mem_info");
+    ATOM(ATOM_messages_drained, "messages_drained");
     ATOM(ATOM_min, "min");
     ATOM(ATOM_more, "more");
     ATOM(ATOM_n_buckets, "n_buckets");
     ATOM(ATOM_nil, "nil");
     ATOM(ATOM_nofin, "nofin");
+    ATOM(ATOM_not_started, "not_started");
     ATOM(ATOM_num_accept, "num_accept");
     ATOM(ATOM_num_children, "num_children");
     ATOM(ATOM_num_listen, "num_listen");
@@ -169,22 +249,41 @@ h2o_nif_globals_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
     ATOM(ATOM_ok, "ok");
     ATOM(ATOM_once, "once");
     ATOM(ATOM_open, "open");
+    ATOM(ATOM_opened, "opened");
+    ATOM(ATOM_p50, "p50");
+    ATOM(ATOM_p90, "p90");
+    ATOM(ATOM_p99, "p99");
+    ATOM(ATOM_p999, "p999");
     ATOM(ATOM_parent, "parent");
+    ATOM(ATOM_pass, "pass");
+    ATOM(ATOM_pass_usec, "pass_usec");
     ATOM(ATOM_port_connect, "port_connect");
     ATOM(ATOM_ports_stat, "ports_stat");
+    ATOM(ATOM_queued, "queued");
     ATOM(ATOM_ready_input, "ready_input");
     ATOM(ATOM_reply, "reply");
+    ATOM(ATOM_request, "request");
     ATOM(ATOM_requested, "requested");
+    ATOM(ATOM_resumptions, "resumptions");
+    ATOM(ATOM_reuseport, "reuseport");
     ATOM(ATOM_send_data, "send_data");
     ATOM(ATOM_seq, "seq");
     ATOM(ATOM_seq_ports, "seq_ports");
+    ATOM(ATOM_server, "server");
     ATOM(ATOM_size, "size");
+    ATOM(ATOM_ssl, "ssl");
     ATOM(ATOM_started, "started");
     ATOM(ATOM_state, "state");
+    ATOM(ATOM_sum, "sum");
+    ATOM(ATOM_ticket_resumptions, "ticket_resumptions");
     ATOM(ATOM_trap, "trap");
     ATOM(ATOM_true, "true");
     ATOM(ATOM_type, "type");
     ATOM(ATOM_undefined, "undefined");
+    ATOM(ATOM_wakeups_received, "wakeups_received");
+    ATOM(ATOM_wakeups_sent, "wakeups_sent");
+    ATOM(ATOM_wakeups_suppressed, "wakeups_suppressed");
+    ATOM(ATOM_watchdog, "watchdog");
 #undef ATOM
 
     return 0;
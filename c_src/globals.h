@@ -89,22 +89,32 @@ extern ERL_NIF_TERM ATOM_$gen_cast;
 extern ERL_NIF_TERM ATOM_accept;
 extern ERL_NIF_TERM ATOM_active;
 extern ERL_NIF_TERM ATOM_already_started;
+extern ERL_NIF_TERM ATOM_at;
 extern ERL_NIF_TERM ATOM_avg;
 extern ERL_NIF_TERM ATOM_badcfg;
+extern ERL_NIF_TERM ATOM_buckets;
+extern ERL_NIF_TERM ATOM_budget_exhausted;
+extern ERL_NIF_TERM ATOM_busy;
+extern ERL_NIF_TERM ATOM_callback;
+extern ERL_NIF_TERM ATOM_callback_usec;
 extern ERL_NIF_TERM ATOM_children;
 extern ERL_NIF_TERM ATOM_closed;
 extern ERL_NIF_TERM ATOM_configured;
 extern ERL_NIF_TERM ATOM_connected;
 extern ERL_NIF_TERM ATOM_continue;
+extern ERL_NIF_TERM ATOM_count;
 extern ERL_NIF_TERM ATOM_eagain;
 extern ERL_NIF_TERM ATOM_entity;
 extern ERL_NIF_TERM ATOM_error;
 extern ERL_NIF_TERM ATOM_false;
+extern ERL_NIF_TERM ATOM_file;
 extern ERL_NIF_TERM ATOM_filter;
+extern ERL_NIF_TERM ATOM_filter_event;
 extern ERL_NIF_TERM ATOM_fin;
 extern ERL_NIF_TERM ATOM_final_input;
 extern ERL_NIF_TERM ATOM_finalize;
 extern ERL_NIF_TERM ATOM_finalized;
+extern ERL_NIF_TERM ATOM_full_handshakes;
 extern ERL_NIF_TERM ATOM_gc_avg;
 extern ERL_NIF_TERM ATOM_gc_max;
 extern ERL_NIF_TERM ATOM_gc_min;
@@ -112,8 +122,11 @@ extern ERL_NIF_TERM ATOM_h2o_handler;
 extern ERL_NIF_TERM ATOM_h2o_port;
 extern ERL_NIF_TERM ATOM_h2o_port_closed;
 extern ERL_NIF_TERM ATOM_h2o_port_data;
+extern ERL_NIF_TERM ATOM_h2o_ports_data;
 extern ERL_NIF_TERM ATOM_h2o_req;
 extern ERL_NIF_TERM ATOM_h2o_res;
+extern ERL_NIF_TERM ATOM_handler;
+extern ERL_NIF_TERM ATOM_handler_event;
 extern ERL_NIF_TERM ATOM_handler_event_read_body;
 extern ERL_NIF_TERM ATOM_handler_event_reply;
 extern ERL_NIF_TERM ATOM_handler_event_stream_body;
@@ -123,14 +136,24 @@ extern ERL_NIF_TERM ATOM_HTTP_1_0;
 extern ERL_NIF_TERM ATOM_HTTP_1_1;
 extern ERL_NIF_TERM ATOM_HTTP_2;
 extern ERL_NIF_TERM ATOM_in_progress;
+extern ERL_NIF_TERM ATOM_ipc;
+extern ERL_NIF_TERM ATOM_ipc_drain;
+extern ERL_NIF_TERM ATOM_leaked;
 extern ERL_NIF_TERM ATOM_listening;
+extern ERL_NIF_TERM ATOM_live;
+extern ERL_NIF_TERM ATOM_logger;
+extern ERL_NIF_TERM ATOM_loop;
+extern ERL_NIF_TERM ATOM_loop_pool;
 extern ERL_NIF_TERM ATOM_max;
+extern ERL_NIF_TERM ATOM_max_drained;
 extern ERL_NIF_TERM ATOM_mem_info;
+extern ERL_NIF_TERM ATOM_messages_drained;
 extern ERL_NIF_TERM ATOM_min;
 extern ERL_NIF_TERM ATOM_more;
 extern ERL_NIF_TERM ATOM_n_buckets;
 extern ERL_NIF_TERM ATOM_nil;
 extern ERL_NIF_TERM ATOM_nofin;
+extern ERL_NIF_TERM ATOM_not_started;
 extern ERL_NIF_TERM ATOM_num_accept;
 extern ERL_NIF_TERM ATOM_num_children;
 extern ERL_NIF_TERM ATOM_num_listen;
@@ -139,22 +162,41 @@ extern ERL_NIF_TERM ATOM_num_ports;
 extern ERL_NIF_TERM ATOM_ok;
 extern ERL_NIF_TERM ATOM_once;
 extern ERL_NIF_TERM ATOM_open;
+extern ERL_NIF_TERM ATOM_opened;
+extern ERL_NIF_TERM ATOM_p50;
+extern ERL_NIF_TERM ATOM_p90;
+extern ERL_NIF_TERM ATOM_p99;
+extern ERL_NIF_TERM ATOM_p999;
 extern ERL_NIF_TERM ATOM_parent;
+extern ERL_NIF_TERM ATOM_pass;
+extern ERL_NIF_TERM ATOM_pass_usec;
 extern ERL_NIF_TERM ATOM_port_connect;
 extern ERL_NIF_TERM ATOM_ports_stat;
+extern ERL_NIF_TERM ATOM_queued;
 extern ERL_NIF_TERM ATOM_ready_input;
 extern ERL_NIF_TERM ATOM_reply;
+extern ERL_NIF_TERM ATOM_request;
 extern ERL_NIF_TERM ATOM_requested;
+extern ERL_NIF_TERM ATOM_resumptions;
+extern ERL_NIF_TERM ATOM_reuseport;
 extern ERL_NIF_TERM ATOM_send_data;
 extern ERL_NIF_TERM ATOM_seq;
 extern ERL_NIF_TERM ATOM_seq_ports;
+extern ERL_NIF_TERM ATOM_server;
 extern ERL_NIF_TERM ATOM_size;
+extern ERL_NIF_TERM ATOM_ssl;
 extern ERL_NIF_TERM ATOM_started;
 extern ERL_NIF_TERM ATOM_state;
+extern ERL_NIF_TERM ATOM_sum;
+extern ERL_NIF_TERM ATOM_ticket_resumptions;
 extern ERL_NIF_TERM ATOM_trap;
 extern ERL_NIF_TERM ATOM_true;
 extern ERL_NIF_TERM ATOM_type;
 extern ERL_NIF_TERM ATOM_undefined;
+extern ERL_NIF_TERM ATOM_wakeups_received;
+extern ERL_NIF_TERM ATOM_wakeups_sent;
+extern ERL_NIF_TERM ATOM_wakeups_suppressed;
+extern ERL_NIF_TERM ATOM_watchdog;
 
 /* NIF Functions */
 
@@ -102,9 +102,13 @@ static ErlNifFunc h2o_nif_funcs[] = {
     {"port_info", 1, h2o_nif_port_info_1},
     {"port_info", 2, h2o_nif_port_info_2},
     {"port_is_alive", 1, h2o_nif_port_is_alive_1},
+    {"port_stats", 0, h2o_nif_port_stats_0},
     // h2o_nif/server.c.h
     {"server_open", 0, h2o_nif_server_open_0},
     {"server_getcfg", 1, h2o_nif_server_getcfg_1},
+    {"server_getstats", 1, h2o_nif_server_getstats_1},
+    {"server_put_certificate", 4, h2o_nif_server_put_certificate_4},
+    {"server_set_threads", 2, h2o_nif_server_set_threads_2},
     {"server_setcfg", 2, h2o_nif_server_setcfg_2},
     {"server_start", 1, h2o_nif_server_start_1},
     // h2o_nif/string.c.h
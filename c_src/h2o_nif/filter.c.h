@@ -70,6 +70,7 @@ h2o_nif_filter_read_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
             count++;
         }
         (void)atomic_fetch_sub_explicit(&filter->num_events, count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&filter->super, count);
         return list;
     }
 
@@ -92,6 +93,7 @@ h2o_nif_filter_read_1_reduce(ErlNifEnv *env, h2o_nif_slicelist_t *slicelist, ERL
     if (node == NULL) {
         h2o_nif_filter_t *filter = (void *)slicelist->data;
         (void)atomic_fetch_sub_explicit(&filter->num_events, slicelist->count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&filter->super, slicelist->count);
         (void)h2o_nif_port_release(&filter->super);
         return list;
     }
@@ -164,7 +164,7 @@ h2o_nif_filter_event_send_3(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         h2o_nif_srv_thread_ctx_t *ctx = (h2o_nif_srv_thread_ctx_t *)event->req->conn->ctx;
         (void)h2o_nif_port_keep(&event->super);
         message->event = event;
-        (void)h2o_nif_ipc_enqueue(ctx->thread->ipc_queue, &message->super);
+        (void)h2o_nif_ipc_enqueue(ctx->thread->loop->ipc_queue, &message->super);
     }
     return ATOM_ok;
 }
@@ -80,6 +80,7 @@ h2o_nif_handler_read_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
             count++;
         }
         (void)atomic_fetch_sub_explicit(&handler->num_events, count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&handler->super, count);
         return list;
     }
 
@@ -160,6 +161,7 @@ h2o_nif_handler_read_trap_3(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         }
         trap->node = node;
         (void)atomic_fetch_sub_explicit(&handler->num_events, count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&handler->super, count);
         if (node == anchor) {
             i = trap->length;
         } else {
@@ -242,7 +244,11 @@ __h2o_nif_handler_event_reply_4(h2o_nif_ipc_handler_event_t *message)
         }
         (void)enif_map_iterator_destroy(env, &iter);
     }
-    (void)h2o_send_inline(req, (const char *)body.data, body.size);
+    if (h2o_nif_handler_file_is_set(&event->finalizer.file)) {
+        (void)h2o_nif_handler_send_file(req, &event->finalizer.file);
+    } else {
+        (void)h2o_send_inline(req, (const char *)body.data, body.size);
+    }
     (void)h2o_nif_port_close_silent(&event->super, NULL, NULL);
     (void)atomic_fetch_sub_explicit(&event->num_async, 1, memory_order_relaxed);
     // (void)h2o_nif_port_release(&event->super);
@@ -332,6 +338,7 @@ h2o_nif_handler_event_batch_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[
     unsigned int status;
     ERL_NIF_TERM headers;
     ErlNifBinary body;
+    h2o_nif_handler_file_t file;
     ERL_NIF_TERM list = argv[0];
     ERL_NIF_TERM head;
     ERL_NIF_TERM tail;
@@ -346,28 +353,48 @@ h2o_nif_handler_event_batch_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[
             continue;
         }
         headers = array[3];
-        if (!enif_get_uint(env, array[2], &status) || status < 100 || status > 599 || !enif_is_map(env, headers) ||
-            !enif_inspect_iolist_as_binary(env, array[4], &body)) {
+        (void)h2o_nif_handler_file_init(&file);
+        if (!enif_get_uint(env, array[2], &status) || status < 100 || status > 599 || !enif_is_map(env, headers)) {
+            continue;
+        }
+        if (enif_is_tuple(env, array[4])) {
+            if (h2o_nif_port_is_send_data(&event->super) || !h2o_nif_handler_file_get(env, array[4], &file)) {
+                continue;
+            }
+        } else if (!enif_inspect_iolist_as_binary(env, array[4], &body)) {
             continue;
         }
         if (!h2o_nif_port_set_finalized(&event->super)) {
+            (void)h2o_nif_handler_file_dispose(&file);
             continue;
         }
-        assert(enif_inspect_iolist_as_binary(trap->env, enif_make_copy(trap->env, array[4]), &body));
+        if (h2o_nif_handler_file_is_set(&file)) {
+            body.data = NULL;
+            body.size = 0;
+        } else {
+            assert(enif_inspect_iolist_as_binary(trap->env, enif_make_copy(trap->env, array[4]), &body));
+        }
         (void)atomic_fetch_add_explicit(&event->num_async, 1, memory_order_relaxed);
         event->finalizer.env = trap->env;
         event->finalizer.status = status;
         event->finalizer.headers = enif_make_copy(trap->env, headers);
         event->finalizer.body = body;
+        event->finalizer.file = file;
         trap->list = enif_make_list_cell(trap->env, enif_make_copy(trap->env, array[1]), trap->list);
     }
-    list = trap->list;
-    while (enif_get_list_cell(trap->env, list, &head, &tail)) {
-        list = tail;
-        if (!h2o_nif_handler_event_get(trap->env, head, &event)) {
-            continue;
+    {
+        /* one splice and at most one wakeup per loop thread for the whole batch */
+        h2o_nif_ipc_many_t many;
+        (void)h2o_nif_ipc_many_init(&many);
+        list = trap->list;
+        while (enif_get_list_cell(trap->env, list, &head, &tail)) {
+            list = tail;
+            if (!h2o_nif_handler_event_get(trap->env, head, &event)) {
+                continue;
+            }
+            (void)h2o_nif_ipc_add_handler_event(&many, event, (h2o_nif_ipc_callback_t *)__h2o_nif_handler_event_reply_4);
         }
-        (void)h2o_nif_ipc_enqueue_handler_event(event, (h2o_nif_ipc_callback_t *)__h2o_nif_handler_event_reply_4);
+        (void)h2o_nif_ipc_enqueue_many(&many);
     }
     (void)ck_pr_stall();
     int done = 1;
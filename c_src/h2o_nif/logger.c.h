@@ -81,6 +81,7 @@ h2o_nif_logger_read_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
             count++;
         }
         (void)atomic_fetch_sub_explicit(&logger->num_events, count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&logger->super, count);
         return list;
     }
 
@@ -173,6 +174,7 @@ h2o_nif_logger_read_trap_3(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         }
         trap->node = node;
         (void)atomic_fetch_sub_explicit(&logger->num_events, count, memory_order_relaxed);
+        (void)h2o_nif_port_stats_dequeued(&logger->super, count);
         if (node == anchor) {
             i = trap->length;
         } else {
@@ -64,6 +64,7 @@ h2o_nif_port_connect_2(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         return enif_make_badarg(env);
     }
     (void)h2o_nif_port_set_owner(port, new_owner);
+    (void)h2o_nif_port_monitor_owner(port, env);
     return ATOM_true;
 }
 
@@ -93,11 +94,7 @@ h2o_nif_port_info_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
     }
     /* parent */
     {
-        ERL_NIF_TERM parent_term;
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        parent_term = (port->parent == NULL) ? ATOM_undefined : h2o_nif_port_make(env, port->parent);
-        (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
-        list[i++] = enif_make_tuple2(env, ATOM_parent, parent_term);
+        list[i++] = enif_make_tuple2(env, ATOM_parent, h2o_nif_port_make_parent(env, port));
     }
     /* state */
     {
@@ -124,16 +121,21 @@ h2o_nif_port_info_2(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         h2o_linklist_t *anchor = NULL;
         h2o_linklist_t *node = NULL;
         h2o_nif_port_t *child = NULL;
+        size_t shard = H2O_NIF_PORT_CHILD_SHARDS;
         out = enif_make_list(env, 0);
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        anchor = &port->children;
-        node = anchor->prev;
-        while (node != anchor) {
-            child = (h2o_nif_port_t *)node;
-            node = node->prev;
-            out = enif_make_list_cell(env, h2o_nif_port_make(env, child), out);
+        /* in opening order within a shard, shards are taken one at a time */
+        while (shard-- > 0) {
+            ck_spinlock_t *lock = h2o_nif_port_children_lock(port, shard);
+            (void)ck_spinlock_lock_eb(lock);
+            anchor = &port->children[shard];
+            node = anchor->prev;
+            while (node != anchor) {
+                child = (h2o_nif_port_t *)node;
+                node = node->prev;
+                out = enif_make_list_cell(env, h2o_nif_port_make(env, child), out);
+            }
+            (void)ck_spinlock_unlock(lock);
         }
-        (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
     } else if (argv[1] == ATOM_connected) {
         ErlNifPid owner = atomic_load_explicit(&port->owner, memory_order_relaxed);
         out = enif_make_pid(env, &owner);
@@ -141,9 +143,7 @@ h2o_nif_port_info_2(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
         int num_children = atomic_load_explicit(&port->num_children, memory_order_relaxed);
         out = enif_make_int(env, num_children);
     } else if (argv[1] == ATOM_parent) {
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        out = (port->parent == NULL) ? ATOM_undefined : h2o_nif_port_make(env, port->parent);
-        (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
+        out = h2o_nif_port_make_parent(env, port);
     } else if (argv[1] == ATOM_state) {
         out = h2o_nif_port_state_to_atom(port);
     } else if (argv[1] == ATOM_type) {
@@ -172,3 +172,18 @@ h2o_nif_port_is_alive_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
     }
     return ATOM_true;
 }
+
+/* fun h2o_nif:port_stats/0 */
+
+static ERL_NIF_TERM
+h2o_nif_port_stats_0(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    if (argc != 0) {
+        return enif_make_badarg(env);
+    }
+    ERL_NIF_TERM out;
+    if (!h2o_nif_port_get_stats(env, &out)) {
+        return enif_make_badarg(env);
+    }
+    return out;
+}
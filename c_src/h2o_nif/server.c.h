@@ -16,6 +16,7 @@ h2o_nif_server_open_0(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
     (void)enif_self(env, &owner);
     (void)h2o_nif_port_set_owner(&server->super, owner);
     assert(h2o_nif_port_set_open(&server->super));
+    (void)h2o_nif_port_monitor_owner(&server->super, env);
     ERL_NIF_TERM out;
     out = h2o_nif_port_make(env, &server->super);
     return out;
@@ -43,6 +44,98 @@ h2o_nif_server_getcfg_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
     return out;
 }
 
+/* fun h2o_nif:server_getstats/1 */
+
+static ERL_NIF_TERM
+h2o_nif_server_getstats_1(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    h2o_nif_server_t *server = NULL;
+    if (argc != 1 || !h2o_nif_server_get(env, argv[0], &server)) {
+        return enif_make_badarg(env);
+    }
+    if (h2o_nif_port_is_closed(&server->super)) {
+        return enif_make_tuple2(env, ATOM_error, ATOM_closed);
+    }
+    ERL_NIF_TERM out;
+    if (!h2o_nif_server_get_stats(server, env, &out)) {
+        return enif_make_badarg(env);
+    }
+    return out;
+}
+
+/* fun h2o_nif:server_put_certificate/4 */
+
+static int
+h2o_nif_server_get_certificate_source(ErlNifEnv *env, ERL_NIF_TERM term, int *is_pem, ErlNifBinary *bin)
+{
+    int arity;
+    const ERL_NIF_TERM *array;
+    if (enif_get_tuple(env, term, &arity, &array)) {
+        if (arity != 2 || array[0] != ATOM_file || !enif_inspect_iolist_as_binary(env, array[1], bin)) {
+            return 0;
+        }
+        *is_pem = 0;
+        return 1;
+    }
+    if (!enif_inspect_iolist_as_binary(env, term, bin)) {
+        return 0;
+    }
+    *is_pem = 1;
+    return 1;
+}
+
+static ERL_NIF_TERM
+h2o_nif_server_put_certificate_4(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    h2o_nif_server_t *server = NULL;
+    if (argc != 4 || !h2o_nif_server_get(env, argv[0], &server)) {
+        return enif_make_badarg(env);
+    }
+    if (h2o_nif_port_is_closed(&server->super)) {
+        return enif_make_tuple2(env, ATOM_error, ATOM_closed);
+    }
+    ErlNifBinary hostname;
+    ErlNifBinary certificate;
+    ErlNifBinary key;
+    int certificate_is_pem;
+    int key_is_pem;
+    if (!enif_inspect_iolist_as_binary(env, argv[1], &hostname) ||
+        !h2o_nif_server_get_certificate_source(env, argv[2], &certificate_is_pem, &certificate) ||
+        !h2o_nif_server_get_certificate_source(env, argv[3], &key_is_pem, &key) || certificate_is_pem != key_is_pem) {
+        return enif_make_badarg(env);
+    }
+    /* takes effect on the next handshake for the name, running or not */
+    if (!h2o_nif_ssl_store_put(&server->config.ssl_store, h2o_iovec_init(hostname.data, hostname.size), certificate_is_pem,
+                               h2o_iovec_init(certificate.data, certificate.size), h2o_iovec_init(key.data, key.size))) {
+        return enif_make_badarg(env);
+    }
+    return ATOM_ok;
+}
+
+/* fun h2o_nif:server_set_threads/2 */
+
+static ERL_NIF_TERM
+h2o_nif_server_set_threads_2(ErlNifEnv *env, int argc, const ERL_NIF_TERM argv[])
+{
+    h2o_nif_server_t *server = NULL;
+    unsigned int num_threads;
+    if (argc != 2 || !h2o_nif_server_get(env, argv[0], &server) || !enif_get_uint(env, argv[1], &num_threads) ||
+        num_threads == 0 || num_threads > H2O_NIF_CONFIG_MAX_THREADS) {
+        return enif_make_badarg(env);
+    }
+    if (h2o_nif_port_is_closed(&server->super)) {
+        return enif_make_tuple2(env, ATOM_error, ATOM_closed);
+    }
+    if (!h2o_nif_port_is_started(&server->super)) {
+        return enif_make_tuple2(env, ATOM_error, ATOM_not_started);
+    }
+    ERL_NIF_TERM reason;
+    if (!h2o_nif_server_set_threads(server, (size_t)num_threads, &reason)) {
+        return enif_make_tuple2(env, ATOM_error, reason);
+    }
+    return ATOM_ok;
+}
+
 /* fun h2o_nif:server_setcfg/2 */
 
 static ERL_NIF_TERM
@@ -2,6 +2,12 @@
 // vim: ts=4 sw=4 ft=c et
 
 #include "handler.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <h2o.h>
 #include <h2o/configurator.h>
 #include <h2o/http1.h>
@@ -22,14 +28,6 @@ struct h2o_nif_handler_data_s {
     ErlNifEnv *env;
 };
 
-typedef struct h2o_nif_handler_deferred_action_s h2o_nif_handler_deferred_action_t;
-
-struct h2o_nif_handler_deferred_action_s {
-    h2o_timeout_entry_t timeout;
-    h2o_nif_handler_t *handler;
-    h2o_req_t *req;
-};
-
 /* Port Functions */
 
 static int h2o_nif_handler_open(h2o_nif_server_t *server, h2o_pathconf_t *pathconf, h2o_nif_handler_t **handlerp);
@@ -45,12 +43,11 @@ h2o_nif_handler_open(h2o_nif_server_t *server, h2o_pathconf_t *pathconf, h2o_nif
 {
     assert(handlerp != NULL);
     h2o_nif_handler_t *handler = NULL;
-    if (!h2o_nif_port_open(&server->super, sizeof(h2o_nif_handler_t), (h2o_nif_port_t **)&handler)) {
+    if (!h2o_nif_port_open(&server->super, H2O_NIF_PORT_TYPE_HANDLER, sizeof(h2o_nif_handler_t), (h2o_nif_port_t **)&handler)) {
         *handlerp = NULL;
         return 0;
     }
     handler->super.dtor = h2o_nif_handler_dtor;
-    handler->super.type = H2O_NIF_PORT_TYPE_HANDLER;
     (void)atomic_init(&handler->ctx, (uintptr_t)NULL);
     handler->state = (atomic_flag)ATOMIC_FLAG_INIT;
     (void)ck_spinlock_init(&handler->spinlock);
@@ -100,7 +97,9 @@ h2o_nif_handler_dtor(ErlNifEnv *env, h2o_nif_port_t *port)
 {
     TRACE_F("h2o_nif_handler_dtor:%s:%d\n", __FILE__, __LINE__);
     assert(port->type == H2O_NIF_PORT_TYPE_HANDLER);
-    // h2o_nif_handler_t *handler = (h2o_nif_handler_t *)port;
+    h2o_nif_handler_t *handler = (h2o_nif_handler_t *)port;
+    /* events nobody read are no longer queued anywhere */
+    (void)h2o_nif_port_stats_dequeued(port, atomic_load_explicit(&handler->num_events, memory_order_relaxed));
     return;
 }
 
@@ -109,16 +108,17 @@ h2o_nif_handler_event_open(h2o_nif_handler_t *handler, h2o_req_t *req, h2o_nif_h
 {
     assert(eventp != NULL);
     h2o_nif_handler_event_t *event = NULL;
-    if (!h2o_nif_port_open(&handler->super, sizeof(h2o_nif_handler_event_t), (h2o_nif_port_t **)&event)) {
+    if (!h2o_nif_port_open(&handler->super, H2O_NIF_PORT_TYPE_HANDLER_EVENT, sizeof(h2o_nif_handler_event_t),
+                           (h2o_nif_port_t **)&event)) {
         *eventp = NULL;
         return 0;
     }
     event->super.dtor = h2o_nif_handler_event_dtor;
-    event->super.type = H2O_NIF_PORT_TYPE_HANDLER_EVENT;
     event->_link.prev = event->_link.next = NULL;
     event->req = req;
     (void)atomic_init(&event->num_async, 0);
     (void)atomic_init(&event->entity_offset, 0);
+    (void)h2o_nif_handler_file_init(&event->finalizer.file);
     // (void)ck_spinlock_init(&event->entity.lock);
     // event->entity.loaded = 0;
     // event->entity.offset = 0;
@@ -141,6 +141,9 @@ h2o_nif_handler_event_dtor(ErlNifEnv *env, h2o_nif_port_t *port)
 {
     TRACE_F("h2o_nif_handler_event_dtor:%s:%d\n", __FILE__, __LINE__);
     assert(port->type == H2O_NIF_PORT_TYPE_HANDLER_EVENT);
+    h2o_nif_handler_event_t *event = (h2o_nif_handler_event_t *)port;
+    /* only set if the reply never reached the loop thread */
+    (void)h2o_nif_handler_file_dispose(&event->finalizer.file);
     return;
 }
 
@@ -334,8 +337,7 @@ h2o_nif_handler_event_make(ErlNifEnv *env, h2o_nif_handler_event_t *event)
         tuple[i++] = tmp;
     }
     /* host */
-    h2o_iovec_to_binary(req->hostconf->authority.host, &tmp);
-    tuple[i++] = tmp;
+    tuple[i++] = h2o_nif_config_make_host(env, req);
     /* method */
     h2o_iovec_to_binary(req->method, &tmp);
     tuple[i++] = tmp;
@@ -361,7 +363,7 @@ h2o_nif_handler_event_make(ErlNifEnv *env, h2o_nif_handler_event_t *event)
         tuple[i++] = peer;
     }
     /* port */
-    tuple[i++] = enif_make_uint(env, req->hostconf->authority.port);
+    tuple[i++] = h2o_nif_config_make_port(env, req);
     /* resp_body */
     tuple[i++] = ATOM_undefined;
     /* resp_cookies */
@@ -369,8 +371,7 @@ h2o_nif_handler_event_make(ErlNifEnv *env, h2o_nif_handler_event_t *event)
     /* resp_headers */
     tuple[i++] = ATOM_undefined;
     /* scheme */
-    h2o_iovec_to_binary(req->scheme->name, &tmp);
-    tuple[i++] = tmp;
+    tuple[i++] = h2o_nif_config_make_scheme(env, req);
     /* streamid */
     tuple[i++] = (stream == NULL) ? ATOM_undefined : enif_make_ulong(env, stream->stream_id);
     /* version */
@@ -400,10 +401,6 @@ h2o_nif_handler_event_make(ErlNifEnv *env, h2o_nif_handler_event_t *event)
 
 /* Handler Functions */
 
-static h2o_nif_handler_deferred_action_t *create_deferred_action(h2o_nif_handler_t *handler, h2o_req_t *req, h2o_timeout_cb cb);
-static void on_deferred_action_dispose(void *_action);
-static void on_ready_input_cb(h2o_timeout_entry_t *entry);
-
 h2o_nif_handler_ctx_t *
 h2o_nif_handler_register(ErlNifEnv *env, h2o_nif_server_t *server, h2o_pathconf_t *pathconf, h2o_nif_handler_handle_t *hh)
 {
@@ -476,59 +473,310 @@ on_req(h2o_handler_t *super, h2o_req_t *req)
             return -1;
         }
         (void)atomic_fetch_add_explicit(&handler->num_events, 1, memory_order_relaxed);
+        (void)h2o_nif_port_stats_enqueued(&handler->super, 1);
         (void)ck_spinlock_lock_eb(&handler->spinlock);
         (void)h2o_linklist_insert(&handler->events, &event->_link);
         (void)ck_spinlock_unlock(&handler->spinlock);
     }
     if (!atomic_flag_test_and_set_explicit(&handler->state, memory_order_relaxed)) {
-        (void)create_deferred_action(handler, req, on_ready_input_cb);
-        // h2o_nif_handler_data_t *handler_data = h2o_context_get_handler_context(req->conn->ctx, super);
-        // ErlNifEnv *env = handler_data->env;
-        // ERL_NIF_TERM msg;
-        // msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &handler->super), ATOM_ready_input);
-        // if (!h2o_nif_port_send(NULL, &handler->super, env, msg)) {
-        //     (void)atomic_flag_clear_explicit(&handler->state, memory_order_relaxed);
-        // }
-        // (void)enif_clear_env(env);
+        (void)h2o_nif_server_ready_input(req->conn->ctx, &handler->super, &handler->state);
     }
 
     return 0;
 }
 
-static h2o_nif_handler_deferred_action_t *
-create_deferred_action(h2o_nif_handler_t *handler, h2o_req_t *req, h2o_timeout_cb cb)
+/* File Functions */
+
+#define H2O_NIF_HANDLER_FILE_CHUNK (64 * 1024)
+
+typedef struct h2o_nif_handler_file_generator_s h2o_nif_handler_file_generator_t;
+
+struct h2o_nif_handler_file_generator_s {
+    h2o_generator_t super;
+    int fd;
+    uint64_t offset;
+    uint64_t bytesleft;
+    char *buf;
+};
+
+static int parse_range(h2o_iovec_t value, uint64_t size, uint64_t *startp, uint64_t *countp);
+static void reset_response_headers(h2o_req_t *req);
+static void on_file_generator_dispose(void *_self);
+static void on_file_generator_proceed(h2o_generator_t *_self, h2o_req_t *req);
+static void on_file_generator_stop(h2o_generator_t *_self, h2o_req_t *req);
+
+int
+h2o_nif_handler_file_get(ErlNifEnv *env, ERL_NIF_TERM term, h2o_nif_handler_file_t *file)
+{
+    int arity;
+    const ERL_NIF_TERM *array;
+    int fd;
+    ErlNifUInt64 offset;
+    ErlNifUInt64 length;
+    ErlNifBinary path_bin;
+    (void)h2o_nif_handler_file_init(file);
+    if (!enif_get_tuple(env, term, &arity, &array) || arity != 4 || array[0] != ATOM_file ||
+        !enif_get_uint64(env, array[2], &offset) || !enif_get_uint64(env, array[3], &length)) {
+        return 0;
+    }
+    if (enif_get_int(env, array[1], &fd)) {
+        if (fd < 0) {
+            return 0;
+        }
+        /* the caller keeps its descriptor, the loop thread closes the duplicate */
+        file->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if (file->fd == -1) {
+            file->error = (errno != 0) ? errno : EIO;
+        }
+    } else if (enif_inspect_iolist_as_binary(env, array[1], &path_bin)) {
+        if (path_bin.size == 0 || path_bin.size >= PATH_MAX || memchr(path_bin.data, '\0', path_bin.size) != NULL) {
+            return 0;
+        }
+        /* opened by `h2o_nif_handler_send_file` on the loop thread */
+        if ((file->path = enif_alloc(path_bin.size + 1)) == NULL) {
+            return 0;
+        }
+        (void)memcpy(file->path, path_bin.data, path_bin.size);
+        file->path[path_bin.size] = '\0';
+    } else {
+        return 0;
+    }
+    file->offset = offset;
+    file->length = length;
+    return 1;
+}
+
+void
+h2o_nif_handler_file_dispose(h2o_nif_handler_file_t *file)
 {
-    h2o_nif_handler_deferred_action_t *action = h2o_mem_alloc_shared(&req->pool, sizeof(*action), on_deferred_action_dispose);
-    *action = (h2o_nif_handler_deferred_action_t){{0, cb}, handler, req};
-    (void)h2o_timeout_link(req->conn->ctx->loop, &req->conn->ctx->zero_timeout, &action->timeout);
-    return action;
+    if (file->fd != -1) {
+        (void)close(file->fd);
+    }
+    if (file->path != NULL) {
+        (void)enif_free(file->path);
+    }
+    (void)h2o_nif_handler_file_init(file);
+}
+
+void
+h2o_nif_handler_send_file(h2o_req_t *req, h2o_nif_handler_file_t *file)
+{
+    TRACE_F("h2o_nif_handler_send_file:%s:%d\n", __FILE__, __LINE__);
+    assert(h2o_nif_handler_file_is_set(file));
+    struct stat st;
+    uint64_t offset = file->offset;
+    uint64_t length = file->length;
+    int is_head = h2o_memis(req->method.base, req->method.len, H2O_STRLIT("HEAD"));
+    h2o_nif_handler_file_generator_t *self = NULL;
+    ssize_t range_index;
+
+    if (file->path != NULL) {
+        while ((file->fd = open(file->path, O_RDONLY | O_CLOEXEC)) == -1 && errno == EINTR)
+            ;
+        if (file->fd == -1) {
+            file->error = (errno != 0) ? errno : EIO;
+        }
+        (void)enif_free(file->path);
+        file->path = NULL;
+    }
+    if (file->fd == -1) {
+        int error = file->error;
+        (void)h2o_nif_handler_file_init(file);
+        /* the headers given for the file don't describe an error page */
+        (void)reset_response_headers(req);
+        if (error == ENOENT || error == ENOTDIR) {
+            (void)h2o_send_error_404(req, "File Not Found", "file not found", 0);
+        } else if (error == EACCES || error == EPERM) {
+            (void)h2o_send_error_403(req, "Access Forbidden", "access forbidden", 0);
+        } else {
+            (void)h2o_send_error_500(req, "Internal Server Error", "failed to open file", 0);
+        }
+        return;
+    }
+    if (fstat(file->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        (void)h2o_nif_handler_file_dispose(file);
+        (void)reset_response_headers(req);
+        (void)h2o_send_error_500(req, "Internal Server Error", "not a regular file", 0);
+        return;
+    }
+    /* clamp the region to what the file holds right now */
+    if (offset > (uint64_t)st.st_size) {
+        offset = (uint64_t)st.st_size;
+    }
+    if (length > (uint64_t)st.st_size - offset) {
+        length = (uint64_t)st.st_size - offset;
+    }
+
+    /* ranges are relative to the region, which is the whole representation as far as the client is concerned */
+    if (req->res.status == 200 && (range_index = h2o_find_header(&req->headers, H2O_TOKEN_RANGE, -1)) != -1) {
+        uint64_t start;
+        uint64_t count;
+        int ret = parse_range(req->headers.entries[range_index].value, length, &start, &count);
+        if (ret == 0) {
+            (void)h2o_nif_handler_file_dispose(file);
+            (void)reset_response_headers(req);
+            char *buf = h2o_mem_alloc_pool(&req->pool, sizeof("bytes */") + 20);
+            size_t len = (size_t)sprintf(buf, "bytes */%" PRIu64, length);
+            req->res.status = 416;
+            req->res.reason = "Range Not Satisfiable";
+            (void)h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_RANGE, NULL, buf, len);
+            (void)h2o_send_inline(req, H2O_STRLIT("requested range not satisfiable"));
+            return;
+        } else if (ret == 1) {
+            char *buf = h2o_mem_alloc_pool(&req->pool, sizeof("bytes -/") + 3 * 20);
+            size_t len = (size_t)sprintf(buf, "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, start, start + count - 1, length);
+            req->res.status = 206;
+            req->res.reason = "Partial Content";
+            (void)h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_CONTENT_RANGE, NULL, buf, len);
+            offset += start;
+            length = count;
+        }
+    }
+    if (req->res.status == 200 || req->res.status == 206) {
+        (void)h2o_add_header(&req->pool, &req->res.headers, H2O_TOKEN_ACCEPT_RANGES, NULL, H2O_STRLIT("bytes"));
+    }
+    req->res.content_length = (size_t)length;
+
+    /* the pool owns the descriptor from here on, closing it whenever the request goes away */
+    self = h2o_mem_alloc_shared(&req->pool, sizeof(*self), on_file_generator_dispose);
+    self->super.proceed = on_file_generator_proceed;
+    self->super.stop = on_file_generator_stop;
+    self->fd = file->fd;
+    self->offset = offset;
+    self->bytesleft = length;
+    self->buf = NULL;
+    (void)h2o_nif_handler_file_init(file);
+
+    (void)h2o_start_response(req, &self->super);
+    if (is_head || self->bytesleft == 0) {
+        (void)close(self->fd);
+        self->fd = -1;
+        (void)h2o_send(req, NULL, 0, H2O_SEND_STATE_FINAL);
+        return;
+    }
+    size_t bufsize = (self->bytesleft < H2O_NIF_HANDLER_FILE_CHUNK) ? (size_t)self->bytesleft : H2O_NIF_HANDLER_FILE_CHUNK;
+    self->buf = h2o_mem_alloc_pool(&req->pool, bufsize);
+    (void)on_file_generator_proceed(&self->super, req);
+}
+
+/*
+ * Parses a single `bytes=` range against a representation of `size` bytes.  Returns 1 for a satisfiable range, 0 for an
+ * unsatisfiable one and -1 when the header should be ignored (malformed or multiple ranges, which are answered with the full
+ * region as RFC 7233 allows).
+ */
+static int
+parse_range(h2o_iovec_t value, uint64_t size, uint64_t *startp, uint64_t *countp)
+{
+    const char *p = value.base;
+    const char *end = value.base + value.len;
+    uint64_t first = 0;
+    uint64_t last = 0;
+    int has_first = 0;
+    int has_last = 0;
+
+    if (value.len < sizeof("bytes=") - 1 || !h2o_lcstris(p, sizeof("bytes=") - 1, H2O_STRLIT("bytes="))) {
+        return -1;
+    }
+    p += sizeof("bytes=") - 1;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+        if (first > (UINT64_MAX - 9) / 10) {
+            return -1;
+        }
+        first = first * 10 + (uint64_t)(*p - '0');
+        has_first = 1;
+    }
+    if (p == end || *p++ != '-') {
+        return -1;
+    }
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+        if (last > (UINT64_MAX - 9) / 10) {
+            return -1;
+        }
+        last = last * 10 + (uint64_t)(*p - '0');
+        has_last = 1;
+    }
+    if (p != end || (!has_first && !has_last)) {
+        return -1;
+    }
+    if (!has_first) {
+        /* suffix range: the last `last` bytes */
+        if (last == 0 || size == 0) {
+            return 0;
+        }
+        if (last > size) {
+            last = size;
+        }
+        *startp = size - last;
+        *countp = last;
+        return 1;
+    }
+    if (has_last && last < first) {
+        return -1;
+    }
+    if (first >= size) {
+        return 0;
+    }
+    if (!has_last || last >= size) {
+        last = size - 1;
+    }
+    *startp = first;
+    *countp = last - first + 1;
+    return 1;
 }
 
 static void
-on_deferred_action_dispose(void *_action)
+reset_response_headers(h2o_req_t *req)
 {
-    h2o_nif_handler_deferred_action_t *action = _action;
-    if (h2o_timeout_is_linked(&action->timeout)) {
-        (void)h2o_timeout_unlink(&action->timeout);
+    req->res.headers = (h2o_headers_t){NULL};
+}
+
+static void
+on_file_generator_dispose(void *_self)
+{
+    h2o_nif_handler_file_generator_t *self = _self;
+    if (self->fd != -1) {
+        (void)close(self->fd);
+        self->fd = -1;
     }
 }
 
 static void
-on_ready_input_cb(h2o_timeout_entry_t *entry)
+on_file_generator_proceed(h2o_generator_t *_self, h2o_req_t *req)
 {
-    h2o_nif_handler_deferred_action_t *action = H2O_STRUCT_FROM_MEMBER(h2o_nif_handler_deferred_action_t, timeout, entry);
-    // if (!h2o_nif_port_send(NULL, &action->handler->super, NULL, ATOM_ready_input)) {
-    //     (void)atomic_flag_clear_explicit(&action->handler->state, memory_order_relaxed);
-    // }
-    h2o_nif_handler_t *handler = action->handler;
-    h2o_nif_handler_ctx_t *ctx = (h2o_nif_handler_ctx_t *)atomic_load_explicit(&handler->ctx, memory_order_relaxed);
-    h2o_req_t *req = action->req;
-    h2o_nif_handler_data_t *handler_data = h2o_context_get_handler_context(req->conn->ctx, &ctx->super);
-    ErlNifEnv *env = handler_data->env;
-    ERL_NIF_TERM msg;
-    msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, &handler->super), ATOM_ready_input);
-    if (!h2o_nif_port_send(NULL, &handler->super, env, msg)) {
-        (void)atomic_flag_clear_explicit(&handler->state, memory_order_relaxed);
-    }
-    (void)enif_clear_env(env);
+    h2o_nif_handler_file_generator_t *self = (h2o_nif_handler_file_generator_t *)_self;
+    size_t len = (self->bytesleft < H2O_NIF_HANDLER_FILE_CHUNK) ? (size_t)self->bytesleft : H2O_NIF_HANDLER_FILE_CHUNK;
+    ssize_t rret;
+    h2o_iovec_t vec;
+    h2o_send_state_t state;
+
+    while ((rret = pread(self->fd, self->buf, len, (off_t)self->offset)) == -1 && errno == EINTR)
+        ;
+    if (rret <= 0) {
+        /* read error, or the file was truncated underneath us */
+        (void)close(self->fd);
+        self->fd = -1;
+        (void)h2o_send(req, NULL, 0, H2O_SEND_STATE_ERROR);
+        return;
+    }
+    self->offset += (uint64_t)rret;
+    self->bytesleft -= (uint64_t)rret;
+    if (self->bytesleft == 0) {
+        (void)close(self->fd);
+        self->fd = -1;
+        state = H2O_SEND_STATE_FINAL;
+    } else {
+        state = H2O_SEND_STATE_IN_PROGRESS;
+    }
+    vec = h2o_iovec_init(self->buf, (size_t)rret);
+    (void)h2o_send(req, &vec, 1, state);
+}
+
+static void
+on_file_generator_stop(h2o_generator_t *_self, h2o_req_t *req)
+{
+    h2o_nif_handler_file_generator_t *self = (h2o_nif_handler_file_generator_t *)_self;
+    if (self->fd != -1) {
+        (void)close(self->fd);
+        self->fd = -1;
+    }
 }
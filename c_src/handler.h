@@ -14,6 +14,7 @@ typedef struct h2o_nif_handler_s h2o_nif_handler_t;
 typedef struct h2o_nif_handler_ctx_s h2o_nif_handler_ctx_t;
 typedef struct h2o_nif_handler_event_s h2o_nif_handler_event_t;
 typedef struct h2o_nif_handler_handle_s h2o_nif_handler_handle_t;
+typedef struct h2o_nif_handler_file_s h2o_nif_handler_file_t;
 // typedef struct h2o_nif_handler_event_generator_s h2o_nif_handler_event_generator_t;
 
 struct h2o_nif_handler_ctx_s {
@@ -21,6 +22,19 @@ struct h2o_nif_handler_ctx_s {
     _Atomic uintptr_t handler;
 };
 
+/*
+ * Region of a file replied with `{file, Path | Fd, Offset, Length}`.  A descriptor is duplicated by the replying scheduler, a path
+ * is only opened by the loop thread so that a slow filesystem never blocks a scheduler.  The loop thread owns either from then
+ * on and streams the region without it ever entering a BEAM heap.
+ */
+struct h2o_nif_handler_file_s {
+    int fd;     /* -1 unless a descriptor is attached */
+    int error;  /* errno of a failed open, reported to the client as 403, 404 or 500 */
+    char *path; /* enif_alloc'ed, set until the loop thread opens it */
+    uint64_t offset;
+    uint64_t length;
+};
+
 struct h2o_nif_handler_event_s {
     h2o_nif_port_t super;
     h2o_linklist_t _link;
@@ -33,6 +47,7 @@ struct h2o_nif_handler_event_s {
         unsigned int status;
         ERL_NIF_TERM headers;
         ErlNifBinary body;
+        h2o_nif_handler_file_t file;
     } finalizer;
 };
 
@@ -97,6 +112,30 @@ h2o_nif_handler_event_get(ErlNifEnv *env, ERL_NIF_TERM port_term, h2o_nif_handle
 extern h2o_nif_handler_ctx_t *h2o_nif_handler_register(ErlNifEnv *env, h2o_nif_server_t *server, h2o_pathconf_t *pathconf,
                                                        h2o_nif_handler_handle_t *hh);
 
+/* File Functions */
+
+static void h2o_nif_handler_file_init(h2o_nif_handler_file_t *file);
+static int h2o_nif_handler_file_is_set(const h2o_nif_handler_file_t *file);
+extern int h2o_nif_handler_file_get(ErlNifEnv *env, ERL_NIF_TERM term, h2o_nif_handler_file_t *file);
+extern void h2o_nif_handler_file_dispose(h2o_nif_handler_file_t *file);
+extern void h2o_nif_handler_send_file(h2o_req_t *req, h2o_nif_handler_file_t *file);
+
+inline void
+h2o_nif_handler_file_init(h2o_nif_handler_file_t *file)
+{
+    file->fd = -1;
+    file->error = 0;
+    file->path = NULL;
+    file->offset = 0;
+    file->length = 0;
+}
+
+inline int
+h2o_nif_handler_file_is_set(const h2o_nif_handler_file_t *file)
+{
+    return (file->fd != -1 || file->error != 0 || file->path != NULL);
+}
+
 /* IPC Functions */
 
 typedef struct h2o_nif_ipc_handler_event_s h2o_nif_ipc_handler_event_t;
@@ -114,6 +153,8 @@ static int h2o_nif_ipc_enqueue_handler_event_1(h2o_nif_handler_event_t *event, v
 static int h2o_nif_ipc_enqueue_handler_event_2(h2o_nif_handler_event_t *event, void *arg0, void *arg1, h2o_nif_ipc_callback_t *cb);
 static int h2o_nif_ipc_enqueue_handler_event_3(h2o_nif_handler_event_t *event, void *arg0, void *arg1, void *arg2,
                                                h2o_nif_ipc_callback_t *cb);
+static int h2o_nif_ipc_add_handler_event(h2o_nif_ipc_many_t *many, h2o_nif_handler_event_t *event, h2o_nif_ipc_callback_t *cb);
+static h2o_nif_ipc_queue_t *h2o_nif_handler_event_ipc_queue(h2o_nif_handler_event_t *event);
 
 inline int
 h2o_nif_ipc_enqueue_handler_event(h2o_nif_handler_event_t *event, h2o_nif_ipc_callback_t *cb)
@@ -137,24 +178,30 @@ inline int
 h2o_nif_ipc_enqueue_handler_event_3(h2o_nif_handler_event_t *event, void *arg0, void *arg1, void *arg2, h2o_nif_ipc_callback_t *cb)
 {
     h2o_nif_ipc_handler_event_t *message = (void *)h2o_nif_ipc_create_message(sizeof(*message), cb, NULL);
-    h2o_nif_srv_thread_ctx_t *ctx = (h2o_nif_srv_thread_ctx_t *)event->req->conn->ctx;
     message->event = event;
     message->arg0 = arg0;
     message->arg1 = arg1;
     message->arg2 = arg2;
-    return h2o_nif_ipc_enqueue(ctx->thread->ipc_queue, (h2o_nif_ipc_message_t *)message);
+    return h2o_nif_ipc_enqueue(h2o_nif_handler_event_ipc_queue(event), (h2o_nif_ipc_message_t *)message);
 }
 
-// inline int
-// h2o_nif_ipc_enqueue_handler_event(h2o_nif_handler_event_t *event, size_t size, h2o_nif_ipc_callback_t *callback)
-// {
-//     assert(size >= sizeof(h2o_nif_ipc_handler_event_t));
-//     h2o_nif_ipc_handler_event_t *message = enif_alloc(sizeof(*message));
-//     h2o_nif_srv_thread_ctx_t *ctx = (h2o_nif_srv_thread_ctx_t *)event->req->conn->ctx;
-//     message->super._link.prev = message->super._link.next = NULL;
-//     message->super.callback = callback;
-//     message->event = event;
-//     return h2o_nif_ipc_enqueue(ctx->thread->ipc_queue, (h2o_nif_ipc_message_t *)message);
-// }
+inline int
+h2o_nif_ipc_add_handler_event(h2o_nif_ipc_many_t *many, h2o_nif_handler_event_t *event, h2o_nif_ipc_callback_t *cb)
+{
+    h2o_nif_ipc_handler_event_t *message = (void *)h2o_nif_ipc_create_message(sizeof(*message), cb, NULL);
+    if (message == NULL) {
+        return 0;
+    }
+    message->event = event;
+    (void)h2o_nif_ipc_many_add(many, h2o_nif_handler_event_ipc_queue(event), (h2o_nif_ipc_message_t *)message);
+    return 1;
+}
+
+inline h2o_nif_ipc_queue_t *
+h2o_nif_handler_event_ipc_queue(h2o_nif_handler_event_t *event)
+{
+    h2o_nif_srv_thread_ctx_t *ctx = (h2o_nif_srv_thread_ctx_t *)event->req->conn->ctx;
+    return ctx->thread->loop->ipc_queue;
+}
 
 #endif
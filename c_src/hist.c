@@ -0,0 +1,173 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#ifdef __linux__
+#define _GNU_SOURCE /* dladdr() */
+#endif
+
+#include <dlfcn.h>
+
+#include "hist.h"
+
+static uint64_t hist_bucket_lower(size_t idx);
+static uint64_t hist_bucket_upper(size_t idx);
+static uint64_t hist_percentile(uint64_t *counts, uint64_t total, uint64_t max, unsigned per_mille);
+static ERL_NIF_TERM watchdog_make_callback(ErlNifEnv *env, uintptr_t callback);
+
+/* Histogram Functions */
+
+void
+h2o_nif_hist_init(h2o_nif_hist_t *hist)
+{
+    size_t i;
+    (void)atomic_init(&hist->sum, 0);
+    (void)atomic_init(&hist->max, 0);
+    for (i = 0; i != H2O_NIF_HIST_NUM_BUCKETS; ++i) {
+        (void)atomic_init(&hist->buckets[i], 0);
+    }
+}
+
+ERL_NIF_TERM
+h2o_nif_hist_make(ErlNifEnv *env, h2o_nif_hist_t *hist)
+{
+    uint64_t counts[H2O_NIF_HIST_NUM_BUCKETS];
+    uint64_t total = 0;
+    uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+    ERL_NIF_TERM buckets = enif_make_list(env, 0);
+    ERL_NIF_TERM list[8];
+    size_t i;
+    /* percentiles are computed from the bucket counts copied here, so they agree with the reported buckets */
+    for (i = 0; i != H2O_NIF_HIST_NUM_BUCKETS; ++i) {
+        counts[i] = atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    i = H2O_NIF_HIST_NUM_BUCKETS;
+    while (i-- > 0) {
+        if (counts[i] != 0) {
+            buckets = enif_make_list_cell(
+                env, enif_make_tuple2(env, enif_make_uint64(env, hist_bucket_lower(i)), enif_make_uint64(env, counts[i])), buckets);
+        }
+    }
+    i = 0;
+#define STAT(Id, Value) list[i++] = enif_make_tuple2(env, Id, enif_make_uint64(env, (ErlNifUInt64)(Value)))
+    STAT(ATOM_count, total);
+    STAT(ATOM_sum, atomic_load_explicit(&hist->sum, memory_order_relaxed));
+    STAT(ATOM_max, max);
+    STAT(ATOM_p50, hist_percentile(counts, total, max, 500));
+    STAT(ATOM_p90, hist_percentile(counts, total, max, 900));
+    STAT(ATOM_p99, hist_percentile(counts, total, max, 990));
+    STAT(ATOM_p999, hist_percentile(counts, total, max, 999));
+#undef STAT
+    list[i++] = enif_make_tuple2(env, ATOM_buckets, buckets);
+    return enif_make_list_from_array(env, list, i);
+}
+
+static uint64_t
+hist_bucket_lower(size_t idx)
+{
+    if (idx < H2O_NIF_HIST_SUB_COUNT) {
+        return (uint64_t)idx;
+    }
+    size_t shift = (idx / H2O_NIF_HIST_SUB_COUNT) - 1;
+    return (uint64_t)(H2O_NIF_HIST_SUB_COUNT + (idx % H2O_NIF_HIST_SUB_COUNT)) << shift;
+}
+
+static uint64_t
+hist_bucket_upper(size_t idx)
+{
+    if (idx < H2O_NIF_HIST_SUB_COUNT) {
+        return (uint64_t)idx;
+    }
+    size_t shift = (idx / H2O_NIF_HIST_SUB_COUNT) - 1;
+    return hist_bucket_lower(idx) + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t
+hist_percentile(uint64_t *counts, uint64_t total, uint64_t max, unsigned per_mille)
+{
+    /* the highest value that falls into the same bucket as the requested rank, never above the recorded maximum */
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (total * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    size_t i;
+    for (i = 0; i != H2O_NIF_HIST_NUM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            uint64_t upper = hist_bucket_upper(i);
+            return (upper > max) ? max : upper;
+        }
+    }
+    return max;
+}
+
+/* Watchdog Functions */
+
+void
+h2o_nif_watchdog_init(h2o_nif_watchdog_t *watchdog, uint64_t threshold_usec)
+{
+    size_t i;
+    watchdog->threshold_usec = threshold_usec;
+    (void)atomic_init(&watchdog->num_entries, 0);
+    for (i = 0; i != H2O_NIF_WATCHDOG_NUM_ENTRIES; ++i) {
+        (void)atomic_init(&watchdog->entries[i].at, 0);
+        (void)atomic_init(&watchdog->entries[i].pass_usec, 0);
+        (void)atomic_init(&watchdog->entries[i].callback, 0);
+        (void)atomic_init(&watchdog->entries[i].callback_usec, 0);
+    }
+}
+
+void
+h2o_nif_watchdog_record(h2o_nif_watchdog_t *watchdog, uint64_t pass_usec, uintptr_t callback, uint64_t callback_usec)
+{
+    uint64_t n = atomic_load_explicit(&watchdog->num_entries, memory_order_relaxed);
+    struct timeval tv;
+    (void)gettimeofday(&tv, NULL);
+    __typeof__(watchdog->entries[0]) *entry = &watchdog->entries[n % H2O_NIF_WATCHDOG_NUM_ENTRIES];
+    (void)atomic_store_explicit(&entry->at, (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec, memory_order_relaxed);
+    (void)atomic_store_explicit(&entry->pass_usec, pass_usec, memory_order_relaxed);
+    (void)atomic_store_explicit(&entry->callback, callback, memory_order_relaxed);
+    (void)atomic_store_explicit(&entry->callback_usec, callback_usec, memory_order_relaxed);
+    (void)atomic_store_explicit(&watchdog->num_entries, n + 1, memory_order_release);
+}
+
+ERL_NIF_TERM
+h2o_nif_watchdog_make(ErlNifEnv *env, h2o_nif_watchdog_t *watchdog)
+{
+    /* oldest first, so the most recent slow pass ends up at the head of the list */
+    uint64_t n = atomic_load_explicit(&watchdog->num_entries, memory_order_acquire);
+    uint64_t first = (n > H2O_NIF_WATCHDOG_NUM_ENTRIES) ? n - H2O_NIF_WATCHDOG_NUM_ENTRIES : 0;
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    uint64_t seq;
+    for (seq = first; seq != n; ++seq) {
+        __typeof__(watchdog->entries[0]) *entry = &watchdog->entries[seq % H2O_NIF_WATCHDOG_NUM_ENTRIES];
+        ERL_NIF_TERM item[4];
+        item[0] = enif_make_tuple2(env, ATOM_at, enif_make_uint64(env, atomic_load_explicit(&entry->at, memory_order_relaxed)));
+        item[1] = enif_make_tuple2(env, ATOM_pass_usec,
+                                   enif_make_uint64(env, atomic_load_explicit(&entry->pass_usec, memory_order_relaxed)));
+        item[2] = enif_make_tuple2(
+            env, ATOM_callback, watchdog_make_callback(env, atomic_load_explicit(&entry->callback, memory_order_relaxed)));
+        item[3] = enif_make_tuple2(env, ATOM_callback_usec,
+                                   enif_make_uint64(env, atomic_load_explicit(&entry->callback_usec, memory_order_relaxed)));
+        list = enif_make_list_cell(env, enif_make_list_from_array(env, item, 4), list);
+    }
+    return list;
+}
+
+static ERL_NIF_TERM
+watchdog_make_callback(ErlNifEnv *env, uintptr_t callback)
+{
+    /*
+     * Most IPC callbacks are static functions missing from the dynamic symbol table, so report the offset into the shared
+     * object instead (resolve it with `addr2line -f -e h2o_nif.so`).  Addresses outside of any object are reported as-is.
+     */
+    Dl_info info;
+    if (callback == 0) {
+        return ATOM_undefined;
+    }
+    if (dladdr((void *)callback, &info) != 0 && info.dli_fbase != NULL) {
+        return enif_make_uint64(env, (ErlNifUInt64)(callback - (uintptr_t)info.dli_fbase));
+    }
+    return enif_make_uint64(env, (ErlNifUInt64)callback);
+}
@@ -0,0 +1,95 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#ifndef H2O_NIF_HIST_H
+#define H2O_NIF_HIST_H
+
+#include "globals.h"
+#include <time.h>
+
+/*
+ * Log-linear (HDR style) histogram of durations in microseconds.  Values below 2^H2O_NIF_HIST_SUB_BITS get a bucket each, every
+ * power of two above that is split into 2^H2O_NIF_HIST_SUB_BITS buckets, so the relative error stays under 12.5% up to
+ * 2^H2O_NIF_HIST_MAX_BITS usec (about 19 hours) where values are clamped.  Only the owning loop thread records, snapshots are
+ * taken concurrently and may be off by the values recorded meanwhile.
+ */
+#define H2O_NIF_HIST_SUB_BITS 3
+#define H2O_NIF_HIST_SUB_COUNT (1 << H2O_NIF_HIST_SUB_BITS)
+#define H2O_NIF_HIST_MAX_BITS 36
+#define H2O_NIF_HIST_NUM_BUCKETS ((H2O_NIF_HIST_MAX_BITS - H2O_NIF_HIST_SUB_BITS + 1) * H2O_NIF_HIST_SUB_COUNT)
+
+/* Number of slow loop passes remembered by the watchdog of each loop thread. */
+#define H2O_NIF_WATCHDOG_NUM_ENTRIES 16
+
+typedef struct h2o_nif_hist_s h2o_nif_hist_t;
+typedef struct h2o_nif_watchdog_s h2o_nif_watchdog_t;
+
+struct h2o_nif_hist_s {
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[H2O_NIF_HIST_NUM_BUCKETS];
+};
+
+/*
+ * Ring of loop passes that took longer than `threshold_usec`, each with the slowest IPC callback that ran during the pass.  Entries
+ * are overwritten in place, so a snapshot racing with the loop thread may see one entry half updated.
+ */
+struct h2o_nif_watchdog_s {
+    uint64_t threshold_usec; /* 0 disables the watchdog */
+    _Atomic uint64_t num_entries;
+    struct {
+        _Atomic uint64_t at; /* wall clock, usec since the epoch */
+        _Atomic uint64_t pass_usec;
+        _Atomic uintptr_t callback;
+        _Atomic uint64_t callback_usec;
+    } entries[H2O_NIF_WATCHDOG_NUM_ENTRIES];
+};
+
+/* Histogram Functions */
+
+extern void h2o_nif_hist_init(h2o_nif_hist_t *hist);
+extern ERL_NIF_TERM h2o_nif_hist_make(ErlNifEnv *env, h2o_nif_hist_t *hist);
+static size_t h2o_nif_hist_bucket_of(uint64_t value);
+static void h2o_nif_hist_record(h2o_nif_hist_t *hist, uint64_t value);
+static uint64_t h2o_nif_hist_now_usec(void);
+
+inline size_t
+h2o_nif_hist_bucket_of(uint64_t value)
+{
+    if (value >= ((uint64_t)1 << H2O_NIF_HIST_MAX_BITS)) {
+        return H2O_NIF_HIST_NUM_BUCKETS - 1;
+    }
+    if (value < H2O_NIF_HIST_SUB_COUNT) {
+        return (size_t)value;
+    }
+    size_t shift = (size_t)(63 - __builtin_clzll(value)) - H2O_NIF_HIST_SUB_BITS;
+    return ((shift + 1) * H2O_NIF_HIST_SUB_COUNT) + (size_t)((value >> shift) - H2O_NIF_HIST_SUB_COUNT);
+}
+
+inline void
+h2o_nif_hist_record(h2o_nif_hist_t *hist, uint64_t value)
+{
+    /* only the owning loop thread writes these, so plain load/store is enough */
+    _Atomic uint64_t *bucket = &hist->buckets[h2o_nif_hist_bucket_of(value)];
+    (void)atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    (void)atomic_store_explicit(&hist->sum, atomic_load_explicit(&hist->sum, memory_order_relaxed) + value, memory_order_relaxed);
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed)) {
+        (void)atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+    }
+}
+
+inline uint64_t
+h2o_nif_hist_now_usec(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
+}
+
+/* Watchdog Functions */
+
+extern void h2o_nif_watchdog_init(h2o_nif_watchdog_t *watchdog, uint64_t threshold_usec);
+extern void h2o_nif_watchdog_record(h2o_nif_watchdog_t *watchdog, uint64_t pass_usec, uintptr_t callback, uint64_t callback_usec);
+extern ERL_NIF_TERM h2o_nif_watchdog_make(ErlNifEnv *env, h2o_nif_watchdog_t *watchdog);
+
+#endif
@@ -33,31 +33,276 @@
 
 #include "ipc.h"
 
+#if H2O_NIF_IPC_USE_EVENTFD
+#include <sys/eventfd.h>
+#endif
+
+typedef struct h2o_nif_ipc_block_s h2o_nif_ipc_block_t;
+typedef struct h2o_nif_ipc_cache_s h2o_nif_ipc_cache_t;
+
+struct h2o_nif_ipc_block_s {
+    h2o_nif_ipc_block_t *next;
+    h2o_nif_ipc_cache_t *cache; /* NULL for oversized blocks */
+    size_t size_class;
+    size_t _unused; /* keeps the message that follows 16-byte aligned */
+};
+
+struct h2o_nif_ipc_cache_s {
+    struct {
+        /* owned by the allocating thread */
+        h2o_nif_ipc_block_t *free;
+        size_t num_free;
+        /* unused buffers exist to avoid false sharing of the cache line */
+        char _unused1_avoid_false_sharing[64];
+        /* blocks handed back in batches by the freeing threads, CACHE_RETIRED once the owner exited */
+        _Atomic(h2o_nif_ipc_block_t *) returned;
+        char _unused2_avoid_false_sharing[64];
+    } classes[H2O_NIF_IPC_NUM_SIZE_CLASSES];
+    /* owned by the allocating thread: blocks handed out and not back in a free list yet */
+    size_t num_out;
+    /* blocks still out once the owner exited; whoever brings it to zero frees the cache */
+    _Atomic int64_t outstanding;
+};
+
+#define CACHE_RETIRED ((h2o_nif_ipc_block_t *)1)
+
+/* cache used by this thread when allocating */
+static _Thread_local h2o_nif_ipc_cache_t *ipc_cache = NULL;
+/* batch of freed blocks waiting to be returned to a single cache, only held while draining a queue */
+static _Thread_local struct {
+    h2o_nif_ipc_cache_t *cache;
+    size_t size_class;
+    h2o_nif_ipc_block_t *head;
+    h2o_nif_ipc_block_t *tail;
+    size_t count;
+    int draining;
+} ipc_freed = {NULL, 0, NULL, NULL, 0, 0};
+
+static void cache_release(h2o_nif_ipc_cache_t *cache, int64_t num_blocks);
 static int cloexec_pipe(int fds[2]);
+static inline uint64_t now_usec(void);
 static void on_read(h2o_socket_t *sock, const char *err);
-static void queue_cb(h2o_nif_ipc_queue_t *queue, int dtor);
+static h2o_nif_ipc_message_t *queue_pop(h2o_nif_ipc_queue_t *queue);
+static size_t queue_cb(h2o_nif_ipc_queue_t *queue, int dtor);
+static size_t queue_drain(h2o_nif_ipc_queue_t *queue);
+static inline int queue_is_empty(h2o_nif_ipc_queue_t *queue);
 static int set_cloexec(int fd);
 
+/* Message Allocator */
+
+static inline size_t
+size_class_of(size_t size)
+{
+    size_t size_class = 0;
+    size_t class_size = H2O_NIF_IPC_MIN_SIZE_CLASS;
+    while (class_size < size) {
+        class_size <<= 1;
+        size_class++;
+    }
+    return size_class;
+}
+
+void *
+h2o_nif_ipc_alloc_message(size_t size)
+{
+    h2o_nif_ipc_block_t *block = NULL;
+    size_t size_class = size_class_of(size);
+    if (size_class >= H2O_NIF_IPC_NUM_SIZE_CLASSES) {
+        block = enif_alloc(sizeof(*block) + size);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->cache = NULL;
+        return (void *)(block + 1);
+    }
+    if (ipc_cache == NULL) {
+        /* caches live for as long as their thread, see `h2o_nif_ipc_thread_exit` */
+        ipc_cache = enif_alloc(sizeof(*ipc_cache));
+        if (ipc_cache == NULL) {
+            return NULL;
+        }
+        (void)memset(ipc_cache, 0, sizeof(*ipc_cache));
+    }
+    h2o_nif_ipc_cache_t *cache = ipc_cache;
+    if (cache->classes[size_class].free == NULL) {
+        /* take back everything other threads have returned since the last refill */
+        h2o_nif_ipc_block_t *returned = NULL;
+        returned = atomic_exchange_explicit(&cache->classes[size_class].returned, NULL, memory_order_acquire);
+        while (returned != NULL) {
+            block = returned;
+            returned = block->next;
+            cache->num_out--;
+            if (cache->classes[size_class].num_free < H2O_NIF_IPC_MAX_CACHED) {
+                block->next = cache->classes[size_class].free;
+                cache->classes[size_class].free = block;
+                cache->classes[size_class].num_free++;
+            } else {
+                (void)enif_free(block);
+            }
+        }
+    }
+    block = cache->classes[size_class].free;
+    if (block != NULL) {
+        cache->classes[size_class].free = block->next;
+        cache->classes[size_class].num_free--;
+    } else {
+        block = enif_alloc(sizeof(*block) + (H2O_NIF_IPC_MIN_SIZE_CLASS << size_class));
+        if (block == NULL) {
+            return NULL;
+        }
+        block->cache = cache;
+        block->size_class = size_class;
+    }
+    cache->num_out++;
+    block->next = NULL;
+    return (void *)(block + 1);
+}
+
+void
+h2o_nif_ipc_free_message(void *ptr)
+{
+    h2o_nif_ipc_block_t *block = ((h2o_nif_ipc_block_t *)ptr) - 1;
+    h2o_nif_ipc_cache_t *cache = block->cache;
+    if (cache == NULL) {
+        (void)enif_free(block);
+        return;
+    }
+    if (cache == ipc_cache) {
+        /* freed by the allocating thread, no need to hand it back */
+        cache->num_out--;
+        if (cache->classes[block->size_class].num_free < H2O_NIF_IPC_MAX_CACHED) {
+            block->next = cache->classes[block->size_class].free;
+            cache->classes[block->size_class].free = block;
+            cache->classes[block->size_class].num_free++;
+        } else {
+            (void)enif_free(block);
+        }
+        return;
+    }
+    if (ipc_freed.cache != cache || ipc_freed.size_class != block->size_class) {
+        (void)h2o_nif_ipc_flush_freed();
+        ipc_freed.cache = cache;
+        ipc_freed.size_class = block->size_class;
+    }
+    block->next = ipc_freed.head;
+    ipc_freed.head = block;
+    if (ipc_freed.tail == NULL) {
+        ipc_freed.tail = block;
+    }
+    /* outside of a drain (a scheduler dropping a message) nothing would flush a partial batch later */
+    if (++ipc_freed.count >= H2O_NIF_IPC_FREE_BATCH || !ipc_freed.draining) {
+        (void)h2o_nif_ipc_flush_freed();
+    }
+}
+
+void
+h2o_nif_ipc_flush_freed(void)
+{
+    if (ipc_freed.head == NULL) {
+        return;
+    }
+    _Atomic(h2o_nif_ipc_block_t *) *returned = &ipc_freed.cache->classes[ipc_freed.size_class].returned;
+    h2o_nif_ipc_block_t *head = atomic_load_explicit(returned, memory_order_acquire);
+    do {
+        if (head == CACHE_RETIRED) {
+            /* the allocating thread is gone, nobody will take these back */
+            h2o_nif_ipc_block_t *block = NULL;
+            while ((block = ipc_freed.head) != NULL) {
+                ipc_freed.head = block->next;
+                (void)enif_free(block);
+            }
+            (void)cache_release(ipc_freed.cache, (int64_t)ipc_freed.count);
+            break;
+        }
+        ipc_freed.tail->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(returned, &head, ipc_freed.head, memory_order_release, memory_order_acquire));
+    ipc_freed.cache = NULL;
+    ipc_freed.head = NULL;
+    ipc_freed.tail = NULL;
+    ipc_freed.count = 0;
+}
+
+void
+h2o_nif_ipc_thread_exit(void)
+{
+    (void)h2o_nif_ipc_flush_freed();
+    h2o_nif_ipc_cache_t *cache = ipc_cache;
+    if (cache == NULL) {
+        return;
+    }
+    ipc_cache = NULL;
+    int64_t num_out = (int64_t)cache->num_out;
+    size_t size_class;
+    for (size_class = 0; size_class < H2O_NIF_IPC_NUM_SIZE_CLASSES; size_class++) {
+        h2o_nif_ipc_block_t *block = NULL;
+        while ((block = cache->classes[size_class].free) != NULL) {
+            cache->classes[size_class].free = block->next;
+            (void)enif_free(block);
+        }
+        /* from now on freeing threads release their blocks themselves */
+        block = atomic_exchange_explicit(&cache->classes[size_class].returned, CACHE_RETIRED, memory_order_acq_rel);
+        while (block != NULL) {
+            h2o_nif_ipc_block_t *next = block->next;
+            (void)enif_free(block);
+            num_out--;
+            block = next;
+        }
+    }
+    (void)cache_release(cache, -num_out);
+}
+
+static void
+cache_release(h2o_nif_ipc_cache_t *cache, int64_t num_blocks)
+{
+    /*
+     * Freeing threads subtract what they released, the exiting owner adds whatever was still out: the sum only reaches zero
+     * once both sides are done.
+     */
+    int64_t prev = atomic_fetch_sub_explicit(&cache->outstanding, num_blocks, memory_order_acq_rel);
+    if (prev == num_blocks) {
+        (void)enif_free(cache);
+    }
+}
+
+/* Queue Functions */
+
 h2o_nif_ipc_queue_t *
-h2o_nif_ipc_create_queue(h2o_loop_t *loop)
+h2o_nif_ipc_create_queue(h2o_loop_t *loop, h2o_nif_ipc_stats_t *stats, size_t budget_messages, uint64_t budget_usec)
 {
+    assert(stats != NULL);
     h2o_nif_ipc_queue_t *queue = enif_alloc(sizeof(*queue));
     if (queue == NULL) {
         return NULL;
     }
     (void)memset(queue, 0, sizeof(*queue));
-    int fds[2];
-    if (cloexec_pipe(fds) != 0) {
-        perror("pipe");
-        abort();
+    int fds[2] = {-1, -1};
+#if H2O_NIF_IPC_USE_EVENTFD
+    if ((fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) != -1) {
+        fds[1] = fds[0];
+        queue->async.eventfd = 1;
+    } else {
+        perror("eventfd (falling back to pipe)");
+    }
+#endif
+    if (!queue->async.eventfd) {
+        if (cloexec_pipe(fds) != 0) {
+            perror("pipe");
+            abort();
+        }
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
     }
-    fcntl(fds[1], F_SETFL, O_NONBLOCK);
     queue->async.flag = (atomic_flag)ATOMIC_FLAG_INIT;
     queue->async.write = fds[1];
     queue->async.read = h2o_evloop_socket_create(loop, fds[0], 0);
+    queue->stats = stats;
+    queue->loop = loop;
+    queue->budget.messages = budget_messages;
+    queue->budget.usec = budget_usec;
+    queue->backlogged = 0;
     queue->async.read->data = queue;
-    (void)ck_spinlock_init(&queue->fifo.spinlock);
-    (void)h2o_linklist_init_anchor(&queue->fifo.messages);
+    (void)atomic_init(&queue->fifo.stub._next, NULL);
+    (void)atomic_init(&queue->fifo.head, &queue->fifo.stub);
+    queue->fifo.tail = &queue->fifo.stub;
     (void)h2o_socket_read_start(queue->async.read, on_read);
     return queue;
 }
@@ -66,14 +311,64 @@ void
 h2o_nif_ipc_destroy_queue(h2o_nif_ipc_queue_t *queue)
 {
     (void)atomic_flag_test_and_set(&queue->async.flag);
+    queue->backlogged = 0;
     (void)h2o_socket_read_stop(queue->async.read);
     (void)h2o_socket_close(queue->async.read);
-    (void)close(queue->async.write);
+    if (!queue->async.eventfd) {
+        (void)close(queue->async.write);
+    }
     (void)queue_cb(queue, 1);
     (void)enif_free(queue);
     return;
 }
 
+size_t
+h2o_nif_ipc_resume(h2o_nif_ipc_queue_t *queue)
+{
+    /* called by the loop thread once `h2o_evloop_run` returned, so sockets got their turn since the budget ran out */
+    if (!queue->backlogged) {
+        return 0;
+    }
+    queue->backlogged = 0;
+    return queue_drain(queue);
+}
+
+/*
+ * Busy polling: between `spin_begin` and `spin_end` the wakeup flag is held set, so producers only push to the fifo and skip
+ * the wakeup write while the loop thread drains it with `spin_poll`.  `spin_end` drops the flag and drains whatever was pushed
+ * meanwhile, after which producers signal the wakeup fd again before the loop thread blocks.
+ */
+void
+h2o_nif_ipc_spin_begin(h2o_nif_ipc_queue_t *queue)
+{
+    (void)atomic_flag_test_and_set(&queue->async.flag);
+}
+
+size_t
+h2o_nif_ipc_spin_poll(h2o_nif_ipc_queue_t *queue)
+{
+    size_t num_drained;
+    if (queue_is_empty(queue)) {
+        return 0;
+    }
+    /* every spin polls the sockets once, so a backlog left by the budget may be resumed here */
+    queue->backlogged = 0;
+    num_drained = queue_drain(queue);
+    /* `queue_cb` cleared the flag; a wakeup written since then is harmless and read on the next poll */
+    (void)atomic_flag_test_and_set(&queue->async.flag);
+    return num_drained;
+}
+
+void
+h2o_nif_ipc_spin_end(h2o_nif_ipc_queue_t *queue)
+{
+    if (queue->backlogged) {
+        /* the budgeted drain keeps the flag set and is resumed after the next poll anyway */
+        return;
+    }
+    (void)queue_drain(queue);
+}
+
 static int
 cloexec_pipe(int fds[2])
 {
@@ -103,48 +398,155 @@ on_read(h2o_socket_t *sock, const char *err)
         fprintf(stderr, "pipe error\n");
         abort();
     }
+    h2o_nif_ipc_queue_t *queue = (h2o_nif_ipc_queue_t *)sock->data;
+    h2o_nif_ipc_stats_t *stats = queue->stats;
+    size_t num_drained;
     (void)h2o_buffer_consume(&sock->input, sock->input->size);
-    (void)queue_cb(sock->data, 0);
+    if (stats->woke_usec == 0) {
+        stats->woke_usec = now_usec();
+    }
+    if (queue->backlogged) {
+        /* a budgeted drain is already waiting for the end of this pass */
+        return;
+    }
+    num_drained = queue_drain(queue);
+    /* only the loop thread writes these, so plain load/store is enough */
+    (void)atomic_store_explicit(&stats->wakeups_received,
+                                atomic_load_explicit(&stats->wakeups_received, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (num_drained > atomic_load_explicit(&stats->max_drained, memory_order_relaxed)) {
+        (void)atomic_store_explicit(&stats->max_drained, num_drained, memory_order_relaxed);
+    }
+}
+
+static size_t
+queue_drain(h2o_nif_ipc_queue_t *queue)
+{
+    /* a backlog is only drained again once the loop thread polled the sockets (see `h2o_nif_ipc_resume`) */
+    assert(!queue->backlogged);
+    h2o_nif_ipc_stats_t *stats = queue->stats;
+    uint64_t started = now_usec();
+    size_t num_drained = queue_cb(queue, 0);
+    if (num_drained != 0) {
+        (void)h2o_nif_hist_record(&stats->drain_usec, now_usec() - started);
+    }
+    (void)atomic_store_explicit(&stats->messages_drained,
+                                atomic_load_explicit(&stats->messages_drained, memory_order_relaxed) + num_drained,
+                                memory_order_relaxed);
+    return num_drained;
+}
+
+static inline uint64_t
+now_usec(void)
+{
+    struct timespec ts;
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + ((uint64_t)ts.tv_nsec / 1000);
 }
 
 static inline int
 queue_is_empty(h2o_nif_ipc_queue_t *queue)
 {
-    int retval;
-    (void)ck_spinlock_lock_eb(&queue->fifo.spinlock);
-    retval = h2o_linklist_is_empty(&queue->fifo.messages);
-    (void)ck_spinlock_unlock(&queue->fifo.spinlock);
-    return retval;
+    return (queue->fifo.tail == &queue->fifo.stub &&
+            atomic_load_explicit(&queue->fifo.head, memory_order_acquire) == &queue->fifo.stub);
 }
 
-static void
+/*
+ * Returns NULL when the queue is empty or when a producer has swapped `head`
+ * but not yet linked its message; in the latter case the producer will either
+ * be observed by the next call or will signal the wakeup pipe itself.
+ */
+static h2o_nif_ipc_message_t *
+queue_pop(h2o_nif_ipc_queue_t *queue)
+{
+    h2o_nif_ipc_message_t *stub = &queue->fifo.stub;
+    h2o_nif_ipc_message_t *tail = queue->fifo.tail;
+    h2o_nif_ipc_message_t *next = atomic_load_explicit(&tail->_next, memory_order_acquire);
+    if (tail == stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->fifo.tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->_next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        queue->fifo.tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&queue->fifo.head, memory_order_acquire)) {
+        return NULL;
+    }
+    (void)__h2o_nif_ipc_push(queue, stub);
+    next = atomic_load_explicit(&tail->_next, memory_order_acquire);
+    if (next != NULL) {
+        queue->fifo.tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+/* how many messages run between clock reads when a time budget is set */
+#define QUEUE_CB_CLOCK_INTERVAL 16
+
+static size_t
 queue_cb(h2o_nif_ipc_queue_t *queue, int dtor)
 {
     // TRACE_F("queue_cb:%s:%d\n", __FILE__, __LINE__);
-    h2o_linklist_t messages;
-    h2o_linklist_t *anchor = &messages;
-    h2o_linklist_t *node = NULL;
     h2o_nif_ipc_message_t *message = NULL;
+    h2o_nif_ipc_stats_t *stats = queue->stats;
+    int time_callbacks = (!dtor && stats->time_callbacks);
+    size_t num_drained = 0;
+    size_t max_messages = (dtor || queue->budget.messages == 0) ? SIZE_MAX : queue->budget.messages;
+    uint64_t deadline = (dtor || queue->budget.usec == 0) ? 0 : now_usec() + queue->budget.usec;
+    ipc_freed.draining = 1;
     do {
         if (!dtor) {
-            (void)atomic_flag_clear_explicit(&queue->async.flag, memory_order_relaxed);
+            (void)atomic_flag_clear(&queue->async.flag);
         }
-        (void)h2o_linklist_init_anchor(&messages);
-        (void)ck_spinlock_lock_eb(&queue->fifo.spinlock);
-        (void)h2o_linklist_insert_list(&messages, &queue->fifo.messages);
-        (void)ck_spinlock_unlock(&queue->fifo.spinlock);
-        node = anchor->next;
-        while (node != anchor) {
-            message = H2O_STRUCT_FROM_MEMBER(h2o_nif_ipc_message_t, _link, node);
-            node = node->next;
-            (void)message->cb(message);
+        while ((message = queue_pop(queue)) != NULL) {
+            if (time_callbacks) {
+                h2o_nif_ipc_callback_t *cb = message->cb;
+                uint64_t started = now_usec();
+                (void)cb(message);
+                uint64_t elapsed = now_usec() - started;
+                if (elapsed > stats->slowest.usec) {
+                    stats->slowest.cb = cb;
+                    stats->slowest.usec = elapsed;
+                }
+            } else {
+                (void)message->cb(message);
+            }
             (void)h2o_nif_ipc_destroy_message(message);
+            num_drained++;
+            if (num_drained >= max_messages ||
+                (deadline != 0 && (num_drained % QUEUE_CB_CLOCK_INTERVAL) == 0 && now_usec() >= deadline)) {
+                goto Exhausted;
+            }
         }
         (void)ck_pr_stall();
     } while (!queue_is_empty(queue));
-    return;
+    /* hand any partial batch of freed messages back to the allocating threads */
+    ipc_freed.draining = 0;
+    (void)h2o_nif_ipc_flush_freed();
+    return num_drained;
+
+Exhausted:
+    ipc_freed.draining = 0;
+    (void)h2o_nif_ipc_flush_freed();
+    if (!queue_is_empty(queue)) {
+        /*
+         * Keep producers from writing wakeups; the resumed drain will pick up their messages.  Nothing in this pass drains the
+         * queue again: a drain re-armed on a zero timeout would run before the evloop gets back to epoll.
+         */
+        (void)atomic_flag_test_and_set(&queue->async.flag);
+        queue->backlogged = 1;
+        (void)atomic_fetch_add_explicit(&stats->budget_exhausted, 1, memory_order_relaxed);
+    }
+    return num_drained;
 }
 
+#undef QUEUE_CB_CLOCK_INTERVAL
+
 static int
 set_cloexec(int fd)
 {
@@ -5,51 +5,150 @@
 #define H2O_NIF_IPC_H
 
 #include "globals.h"
+#include "hist.h"
 #include <errno.h>
 
+/* eventfd(2) is used for wakeups on Linux unless disabled with -DH2O_NIF_IPC_USE_EVENTFD=0 */
+#ifndef H2O_NIF_IPC_USE_EVENTFD
+#ifdef __linux__
+#define H2O_NIF_IPC_USE_EVENTFD 1
+#else
+#define H2O_NIF_IPC_USE_EVENTFD 0
+#endif
+#endif
+
 typedef struct h2o_nif_ipc_queue_s h2o_nif_ipc_queue_t;
 typedef struct h2o_nif_ipc_message_s h2o_nif_ipc_message_t;
+typedef struct h2o_nif_ipc_stats_s h2o_nif_ipc_stats_t;
+typedef struct h2o_nif_ipc_many_s h2o_nif_ipc_many_t;
 typedef void h2o_nif_ipc_callback_t(h2o_nif_ipc_message_t *message);
 
+struct h2o_nif_ipc_stats_s {
+    /*
+     * `wakeups_sent` is the only counter written by producers, it gets a cache line of its own.  Suppressed wakeups are not
+     * counted at all: they are the common case of an enqueue and are derived from the drain counters instead.
+     */
+    _Atomic uint64_t wakeups_sent; /* writes to the wakeup fd made by producers */
+    char _unused1_avoid_false_sharing[128 - sizeof(uint64_t)];
+    _Atomic uint64_t wakeups_received; /* number of times the loop thread drained the queue */
+    _Atomic uint64_t messages_drained; /* total number of messages run by the loop thread */
+    _Atomic uint64_t max_drained;      /* largest number of messages drained by a single wakeup */
+    _Atomic uint64_t budget_exhausted; /* drains cut short by the per-pass budget and resumed after the next poll */
+    h2o_nif_hist_t drain_usec;         /* time spent running the messages of one drain */
+    /*
+     * Loop thread only: when `time_callbacks` is set every callback is timed and the slowest one since the loop thread last
+     * reset `slowest` is kept for the watchdog.
+     */
+    int time_callbacks;
+    struct {
+        h2o_nif_ipc_callback_t *cb;
+        uint64_t usec;
+    } slowest;
+    uint64_t woke_usec; /* loop thread only: when a wakeup was first read since the loop thread last reset it */
+};
+
+struct h2o_nif_ipc_message_s {
+    _Atomic(h2o_nif_ipc_message_t *) _next;
+    h2o_nif_ipc_callback_t *cb;
+    h2o_nif_ipc_callback_t *dtor;
+};
+
+/*
+ * The fifo is an intrusive multi-producer/single-consumer queue (Vyukov).
+ * Producers only ever touch `head` with a single atomic exchange, so enqueue
+ * cost does not depend on the number of concurrent schedulers and never fails.
+ * The consumer (the loop thread) owns `tail` and the `stub` node.
+ */
 struct h2o_nif_ipc_queue_s {
     struct {
         atomic_flag flag;
+        int eventfd; /* non-zero when `write` is the same eventfd as `read` */
         int write;
         h2o_socket_t *read;
     } async;
+    h2o_nif_ipc_stats_t *stats;
+    h2o_loop_t *loop;
+    /*
+     * Per-pass drain budget (0 means unlimited).  When either limit is hit the
+     * remaining messages are left in the fifo and `backlogged` is set: the loop
+     * thread then polls without blocking and resumes the drain with
+     * h2o_nif_ipc_resume() once pending socket I/O has been handled.
+     */
+    struct {
+        size_t messages;
+        uint64_t usec;
+    } budget;
+    int backlogged; /* loop thread only */
     struct {
-        ck_spinlock_t spinlock;
-        h2o_linklist_t messages;
+        /* unused buffers exist to avoid false sharing of the cache line */
+        char _unused1_avoid_false_sharing[64];
+        _Atomic(h2o_nif_ipc_message_t *) head;
+        char _unused2_avoid_false_sharing[64];
+        h2o_nif_ipc_message_t *tail;
+        h2o_nif_ipc_message_t stub;
     } fifo;
 };
 
-struct h2o_nif_ipc_message_s {
-    h2o_linklist_t _link;
-    h2o_nif_ipc_callback_t *cb;
-    h2o_nif_ipc_callback_t *dtor;
+/*
+ * Accumulates messages for h2o_nif_ipc_enqueue_many(), grouped by destination
+ * queue.  Each group is spliced into its queue with a single atomic exchange and
+ * costs at most one wakeup, regardless of how many messages it holds.
+ */
+#define H2O_NIF_IPC_MANY_MAX_QUEUES 64
+
+struct h2o_nif_ipc_many_s {
+    size_t num_groups;
+    struct {
+        h2o_nif_ipc_queue_t *queue;
+        h2o_nif_ipc_message_t *first;
+        h2o_nif_ipc_message_t *last;
+    } groups[H2O_NIF_IPC_MANY_MAX_QUEUES];
 };
 
-extern h2o_nif_ipc_queue_t *h2o_nif_ipc_create_queue(h2o_loop_t *loop);
+/* Message Allocator */
+
+/*
+ * Messages are allocated by scheduler threads and freed by loop threads.  Each
+ * allocating thread owns a size-classed free-list cache; loop threads hand freed
+ * blocks back to their owning cache in batches of H2O_NIF_IPC_FREE_BATCH with a
+ * single atomic operation.  Messages larger than the biggest size class bypass
+ * the caches and go straight to enif_alloc/enif_free.  Threads that exit call
+ * h2o_nif_ipc_thread_exit(); their cache is freed once every block is back.
+ */
+#define H2O_NIF_IPC_NUM_SIZE_CLASSES 4
+#define H2O_NIF_IPC_MIN_SIZE_CLASS 64
+#define H2O_NIF_IPC_MAX_CACHED 1024
+#define H2O_NIF_IPC_FREE_BATCH 32
+
+extern void *h2o_nif_ipc_alloc_message(size_t size);
+extern void h2o_nif_ipc_free_message(void *ptr);
+extern void h2o_nif_ipc_flush_freed(void);
+extern void h2o_nif_ipc_thread_exit(void);
+
+/* Queue Functions */
+
+extern h2o_nif_ipc_queue_t *h2o_nif_ipc_create_queue(h2o_loop_t *loop, h2o_nif_ipc_stats_t *stats, size_t budget_messages,
+                                                     uint64_t budget_usec);
 extern void h2o_nif_ipc_destroy_queue(h2o_nif_ipc_queue_t *queue);
+extern size_t h2o_nif_ipc_resume(h2o_nif_ipc_queue_t *queue);
+extern void h2o_nif_ipc_spin_begin(h2o_nif_ipc_queue_t *queue);
+extern size_t h2o_nif_ipc_spin_poll(h2o_nif_ipc_queue_t *queue);
+extern void h2o_nif_ipc_spin_end(h2o_nif_ipc_queue_t *queue);
 static h2o_nif_ipc_message_t *h2o_nif_ipc_create_message(size_t size, h2o_nif_ipc_callback_t *cb, h2o_nif_ipc_callback_t *dtor);
 static void h2o_nif_ipc_destroy_message(h2o_nif_ipc_message_t *message);
-// static int h2o_nif_ipc_send(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_callback_t *callback, void *data);
 static int h2o_nif_ipc_enqueue(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message);
-
-// inline int
-// h2o_nif_ipc_send(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_callback_t *callback, void *data)
-// {
-//     h2o_nif_ipc_message_t *message = enif_alloc(sizeof(*message));
-//     message->callback = callback;
-//     message->data = data;
-//     return h2o_nif_ipc_enqueue(queue, message);
-// }
+static void __h2o_nif_ipc_push(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message);
+static void __h2o_nif_ipc_wakeup(h2o_nif_ipc_queue_t *queue);
+static void h2o_nif_ipc_many_init(h2o_nif_ipc_many_t *many);
+static void h2o_nif_ipc_many_add(h2o_nif_ipc_many_t *many, h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message);
+static int h2o_nif_ipc_enqueue_many(h2o_nif_ipc_many_t *many);
+static int h2o_nif_ipc_queue_is_backlogged(h2o_nif_ipc_queue_t *queue);
 
 inline h2o_nif_ipc_message_t *
 h2o_nif_ipc_create_message(size_t size, h2o_nif_ipc_callback_t *cb, h2o_nif_ipc_callback_t *dtor)
 {
     assert(size >= sizeof(h2o_nif_ipc_message_t));
-    h2o_nif_ipc_message_t *message = enif_alloc(size);
+    h2o_nif_ipc_message_t *message = h2o_nif_ipc_alloc_message(size);
     if (message == NULL) {
         return NULL;
     }
@@ -65,7 +164,38 @@ h2o_nif_ipc_destroy_message(h2o_nif_ipc_message_t *message)
     if (message->dtor != NULL) {
         message->dtor(message);
     }
-    (void)enif_free(message);
+    (void)h2o_nif_ipc_free_message(message);
+    return;
+}
+
+inline void
+__h2o_nif_ipc_push(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message)
+{
+    h2o_nif_ipc_message_t *prev = NULL;
+    (void)atomic_store_explicit(&message->_next, NULL, memory_order_relaxed);
+    prev = atomic_exchange_explicit(&queue->fifo.head, message, memory_order_acq_rel);
+    (void)atomic_store_explicit(&prev->_next, message, memory_order_release);
+}
+
+inline void
+__h2o_nif_ipc_wakeup(h2o_nif_ipc_queue_t *queue)
+{
+    if (atomic_flag_test_and_set(&queue->async.flag) == true) {
+        return;
+    }
+    (void)atomic_fetch_add_explicit(&queue->stats->wakeups_sent, 1, memory_order_relaxed);
+#if H2O_NIF_IPC_USE_EVENTFD
+    if (queue->async.eventfd) {
+        uint64_t one = 1;
+        while (write(queue->async.write, &one, sizeof(one)) == -1 && errno == EINTR) {
+            (void)ck_pr_stall();
+        }
+        return;
+    }
+#endif
+    while (write(queue->async.write, "", 1) == -1 && errno == EINTR) {
+        (void)ck_pr_stall();
+    }
     return;
 }
 
@@ -74,28 +204,62 @@ h2o_nif_ipc_enqueue(h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message)
 {
     // assert(queue != NULL);
     // assert(message != NULL);
-    (void)ck_spinlock_lock_eb(&queue->fifo.spinlock);
-    (void)h2o_linklist_insert(&queue->fifo.messages, &message->_link);
-    (void)ck_spinlock_unlock(&queue->fifo.spinlock);
-    if (atomic_flag_test_and_set_explicit(&queue->async.flag, memory_order_relaxed) == false) {
-        while (write(queue->async.write, "", 1) == -1 && errno == EINTR) {
-            (void)ck_pr_stall();
+    (void)__h2o_nif_ipc_push(queue, message);
+    (void)__h2o_nif_ipc_wakeup(queue);
+    return 1;
+}
+
+inline void
+h2o_nif_ipc_many_init(h2o_nif_ipc_many_t *many)
+{
+    many->num_groups = 0;
+}
+
+inline void
+h2o_nif_ipc_many_add(h2o_nif_ipc_many_t *many, h2o_nif_ipc_queue_t *queue, h2o_nif_ipc_message_t *message)
+{
+    size_t i;
+    (void)atomic_store_explicit(&message->_next, NULL, memory_order_relaxed);
+    for (i = 0; i != many->num_groups; ++i) {
+        if (many->groups[i].queue == queue) {
+            (void)atomic_store_explicit(&many->groups[i].last->_next, message, memory_order_relaxed);
+            many->groups[i].last = message;
+            return;
         }
     }
+    if (many->num_groups == H2O_NIF_IPC_MANY_MAX_QUEUES) {
+        (void)h2o_nif_ipc_enqueue_many(many);
+    }
+    i = many->num_groups++;
+    many->groups[i].queue = queue;
+    many->groups[i].first = message;
+    many->groups[i].last = message;
+}
+
+inline int
+h2o_nif_ipc_enqueue_many(h2o_nif_ipc_many_t *many)
+{
+    h2o_nif_ipc_queue_t *queue = NULL;
+    h2o_nif_ipc_message_t *prev = NULL;
+    size_t i;
+    for (i = 0; i != many->num_groups; ++i) {
+        queue = many->groups[i].queue;
+        /* the release store publishes the whole pre-linked chain to the consumer */
+        prev = atomic_exchange_explicit(&queue->fifo.head, many->groups[i].last, memory_order_acq_rel);
+        (void)atomic_store_explicit(&prev->_next, many->groups[i].first, memory_order_release);
+        (void)__h2o_nif_ipc_wakeup(queue);
+    }
+    many->num_groups = 0;
     return 1;
-    // ck_fifo_mpmc_entry_t *fifo_entry = (ck_fifo_mpmc_entry_t *)malloc(sizeof(*fifo_entry));
-    // if (fifo_entry == NULL) {
-    //     return 0;
-    // }
-    // while (ck_fifo_mpmc_tryenqueue(&queue->fifo, fifo_entry, (void *)message) == false) {
-    //     (void)ck_pr_stall();
-    // }
-    // if (atomic_flag_test_and_set_explicit(&queue->flag, memory_order_relaxed) == false) {
-    //     while (write(queue->write, "", 1) == -1 && errno == EINTR) {
-    //         (void)ck_pr_stall();
-    //     }
-    // }
-    // return 1;
+}
+
+/*
+ * True while a drain cut short by the per-pass budget is waiting to run.  Only meaningful on the loop thread owning the queue.
+ */
+inline int
+h2o_nif_ipc_queue_is_backlogged(h2o_nif_ipc_queue_t *queue)
+{
+    return queue->backlogged;
 }
 
 #endif
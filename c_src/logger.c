@@ -28,12 +28,11 @@ h2o_nif_logger_open(h2o_nif_server_t *server, h2o_pathconf_t *pathconf, h2o_nif_
 {
     assert(loggerp != NULL);
     h2o_nif_logger_t *logger = NULL;
-    if (!h2o_nif_port_open(&server->super, sizeof(h2o_nif_logger_t), (h2o_nif_port_t **)&logger)) {
+    if (!h2o_nif_port_open(&server->super, H2O_NIF_PORT_TYPE_LOGGER, sizeof(h2o_nif_logger_t), (h2o_nif_port_t **)&logger)) {
         *loggerp = NULL;
         return 0;
     }
     logger->super.dtor = h2o_nif_logger_dtor;
-    logger->super.type = H2O_NIF_PORT_TYPE_LOGGER;
     (void)atomic_init(&logger->ctx, (uintptr_t)NULL);
     (void)h2o_mem_addref_shared(lh);
     logger->lh = lh;
@@ -87,6 +86,8 @@ h2o_nif_logger_dtor(ErlNifEnv *env, h2o_nif_port_t *port)
     assert(port->type == H2O_NIF_PORT_TYPE_LOGGER);
     h2o_nif_logger_t *logger = (h2o_nif_logger_t *)port;
     (void)h2o_mem_release_shared(logger->lh);
+    /* events nobody read are no longer queued anywhere */
+    (void)h2o_nif_port_stats_dequeued(port, atomic_load_explicit(&logger->num_events, memory_order_relaxed));
     return;
 }
 
@@ -169,6 +170,7 @@ on_log_access(h2o_logger_t *super, h2o_req_t *req)
         event->binary = binary;
         (void)memcpy(binary.data + sizeof(h2o_nif_logger_event_t), logline, len);
         (void)atomic_fetch_add_explicit(&logger->num_events, 1, memory_order_relaxed);
+        (void)h2o_nif_port_stats_enqueued(&logger->super, 1);
         (void)ck_spinlock_lock_eb(&logger->spinlock);
         (void)h2o_linklist_insert(&logger->events, &event->_link);
         (void)ck_spinlock_unlock(&logger->spinlock);
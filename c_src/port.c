@@ -3,16 +3,40 @@
 
 #include "port.h"
 
-ck_spinlock_t h2o_nif_ports_spinlock = CK_SPINLOCK_INITIALIZER;
+h2o_nif_port_lock_t h2o_nif_ports_locks[H2O_NIF_PORT_NUM_LOCKS];
+h2o_nif_port_stats_shard_t h2o_nif_ports_stats[H2O_NIF_PORT_STATS_SHARDS];
+_Thread_local h2o_nif_port_stats_shard_t *h2o_nif_ports_stats_shard = NULL;
 ErlNifResourceType *h2o_nif_port_resource_type = NULL;
 
+static _Atomic size_t port_stats_next_shard = 0;
+
+static void port_demonitor(h2o_nif_port_t *port, ErlNifEnv *env);
+static void port_demonitor_owner(h2o_nif_port_t *port, ErlNifEnv *env);
+static void port_link(h2o_nif_port_t *parent, h2o_nif_port_t *port);
+
 /* NIF Functions */
 
 int
 h2o_nif_port_load(ErlNifEnv *env, h2o_nif_data_t *nif_data)
 {
+    size_t i;
+    for (i = 0; i != H2O_NIF_PORT_NUM_LOCKS; ++i) {
+        (void)ck_spinlock_init(&h2o_nif_ports_locks[i].lock);
+    }
+    for (i = 0; i != H2O_NIF_PORT_STATS_SHARDS; ++i) {
+        size_t type;
+        for (type = 0; type != H2O_NIF_PORT_NUM_TYPES; ++type) {
+            h2o_nif_port_stats_t *stats = &h2o_nif_ports_stats[i].types[type];
+            (void)atomic_init(&stats->opened, 0);
+            (void)atomic_init(&stats->closed, 0);
+            (void)atomic_init(&stats->destroyed, 0);
+            (void)atomic_init(&stats->leaked, 0);
+            (void)atomic_init(&stats->queued, 0);
+        }
+    }
+    ErlNifResourceTypeInit init = {.dtor = h2o_nif_port_dtor, .stop = NULL, .down = h2o_nif_port_down};
     h2o_nif_port_resource_type =
-        enif_open_resource_type(env, NULL, "h2o_nif_port", h2o_nif_port_dtor, ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
+        enif_open_resource_type_x(env, "h2o_nif_port", &init, ERL_NIF_RT_CREATE | ERL_NIF_RT_TAKEOVER, NULL);
     return 0;
 }
 
@@ -40,8 +64,14 @@ h2o_nif_port_alloc(size_t size)
     }
     (void)memset(port, 0, size);
     (void)atomic_init(&port->state, H2O_NIF_PORT_STATE_ALLOCATED);
-    (void)h2o_linklist_init_anchor(&port->children);
+    size_t i;
+    for (i = 0; i != H2O_NIF_PORT_CHILD_SHARDS; ++i) {
+        (void)h2o_linklist_init_anchor(&port->children[i]);
+    }
     (void)atomic_init(&port->num_children, 0);
+    (void)ck_spinlock_init(&port->monitor.lock);
+    port->monitor.active = 0;
+    port->monitor.pending = 0;
     return port;
 }
 
@@ -51,41 +81,80 @@ h2o_nif_port_dtor(ErlNifEnv *env, void *obj)
     TRACE_F("h2o_nif_port_dtor:%s:%d\n", __FILE__, __LINE__);
     h2o_nif_port_t *port = (h2o_nif_port_t *)obj;
     if (!h2o_nif_port_is_closed(port)) {
-        TRACE_F("SHOULD NEVER HAPPEN: port dtor called for non-closed port\n");
-        perror("non-closed port dtor:");
-        exit(1);
+        (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(port->type)->leaked, 1, memory_order_relaxed);
+        (void)fprintf(stderr, "[warning] port of type %d destroyed without being closed\n", port->type);
     }
     if (port->dtor != NULL) {
         (void)port->dtor(env, port);
     }
+    (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(port->type)->destroyed, 1, memory_order_relaxed);
+    return;
+}
+
+void
+h2o_nif_port_down(ErlNifEnv *env, void *obj, ErlNifPid *pid, ErlNifMonitor *mon)
+{
+    TRACE_F("h2o_nif_port_down:%s:%d\n", __FILE__, __LINE__);
+    h2o_nif_port_t *port = (h2o_nif_port_t *)obj;
+    int owner_down = 0;
+    int stale = 0;
+    (void)ck_spinlock_lock_eb(&port->monitor.lock);
+    if (port->monitor.active && enif_compare_monitors(&port->monitor.monitor, mon) == 0) {
+        port->monitor.active = 0;
+        owner_down = 1;
+        /* the close drops the allocation reference only after taking this lock, keep the port until the close is over */
+        (void)h2o_nif_port_keep(port);
+    } else if (port->monitor.pending > 0) {
+        /* a monitor that could no longer be removed, only the current one closes the port */
+        port->monitor.pending--;
+        stale = 1;
+    }
+    (void)ck_spinlock_unlock(&port->monitor.lock);
+    if (owner_down) {
+        (void)h2o_nif_port_close_silent(port, NULL, NULL);
+        (void)h2o_nif_port_release(port);
+    } else if (stale) {
+        (void)h2o_nif_port_release(port);
+    }
     return;
 }
 
 /* Port Functions */
 
 int
-h2o_nif_port_open(h2o_nif_port_t *parent, size_t size, h2o_nif_port_t **portp)
+h2o_nif_port_open(h2o_nif_port_t *parent, int type, size_t size, h2o_nif_port_t **portp)
 {
     assert(portp != NULL);
+    assert(type >= 0 && type < H2O_NIF_PORT_NUM_TYPES);
     h2o_nif_port_t *port = h2o_nif_port_alloc(size);
     if (port == NULL) {
         *portp = NULL;
         return 0;
     }
+    port->type = type;
+    (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(type)->opened, 1, memory_order_relaxed);
     if (parent != NULL) {
-        (void)h2o_nif_port_keep(parent);
-        port->parent = parent;
-        (void)h2o_nif_port_keep(port);
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        (void)h2o_linklist_insert(&parent->children, &port->_link);
-        (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
-        (void)atomic_fetch_add_explicit(&parent->num_children, 1, memory_order_relaxed);
-        (void)h2o_nif_port_set_owner(port, h2o_nif_port_get_owner(parent));
+        (void)port_link(parent, port);
     }
     *portp = port;
     return 1;
 }
 
+static void
+port_link(h2o_nif_port_t *parent, h2o_nif_port_t *port)
+{
+    size_t shard = h2o_nif_port_child_shard(port);
+    ck_spinlock_t *lock = h2o_nif_port_children_lock(parent, shard);
+    (void)h2o_nif_port_keep(parent);
+    port->parent = parent;
+    (void)h2o_nif_port_keep(port);
+    (void)ck_spinlock_lock_eb(lock);
+    (void)h2o_linklist_insert(&parent->children[shard], &port->_link);
+    (void)ck_spinlock_unlock(lock);
+    (void)atomic_fetch_add_explicit(&parent->num_children, 1, memory_order_relaxed);
+    (void)h2o_nif_port_set_owner(port, h2o_nif_port_get_owner(parent));
+}
+
 int
 h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out)
 {
@@ -97,6 +166,7 @@ h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out)
         }
         return 0;
     }
+    (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(port->type)->closed, 1, memory_order_relaxed);
     port->on_close.state = state;
     return (__h2o_nif_port_close(port, env, out));
 }
@@ -112,6 +182,7 @@ h2o_nif_port_close_silent(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *ou
         }
         return 0;
     }
+    (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(port->type)->closed, 1, memory_order_relaxed);
     port->on_close.state = state;
     port->on_close.silent = 1;
     return (__h2o_nif_port_close(port, env, out));
@@ -161,31 +232,37 @@ __h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out)
         // Finished with callback
         port->on_close.callback = NULL;
     }
+    // Stop watching the owner, its death no longer matters
+    (void)port_demonitor_owner(port, env);
     // Send closed message to owner if port was open
     if (((port->on_close.state & H2O_NIF_PORT_STATE_OPEN) == H2O_NIF_PORT_STATE_OPEN) && !port->on_close.silent) {
-        ErlNifEnv *msg_env = (is_direct_call) ? env : enif_alloc_env();
+        ErlNifEnv *msg_env = (is_direct_call) ? env : h2o_nif_env_acquire();
         ERL_NIF_TERM msg = enif_make_tuple2(msg_env, ATOM_h2o_port_closed, h2o_nif_port_make(msg_env, port));
         if (is_direct_call) {
             (void)h2o_nif_port_send(msg_env, port, NULL, msg);
         } else {
             (void)h2o_nif_port_send(NULL, port, msg_env, msg);
-            (void)enif_free_env(msg_env);
+            (void)h2o_nif_env_release(msg_env);
         }
     }
-    // Unlink from parent, if present
+    // Unlink from parent, if present (the parent may be unlinking this port concurrently, whoever clears `parent` wins)
     {
-        h2o_nif_port_t *parent = NULL;
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        parent = port->parent;
+        h2o_nif_port_t *parent = ck_pr_load_ptr(&port->parent);
         if (parent != NULL) {
-            (void)h2o_linklist_unlink(&port->_link);
-            port->parent = NULL;
-            (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
-            (void)atomic_fetch_sub_explicit(&parent->num_children, 1, memory_order_relaxed);
-            (void)h2o_nif_port_release(parent);
-            (void)h2o_nif_port_release(port);
-        } else {
-            (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
+            ck_spinlock_t *lock = h2o_nif_port_children_lock(parent, h2o_nif_port_child_shard(port));
+            int unlinked = 0;
+            (void)ck_spinlock_lock_eb(lock);
+            if (port->parent == parent) {
+                (void)h2o_linklist_unlink(&port->_link);
+                (void)ck_pr_store_ptr(&port->parent, NULL);
+                unlinked = 1;
+            }
+            (void)ck_spinlock_unlock(lock);
+            if (unlinked) {
+                (void)atomic_fetch_sub_explicit(&parent->num_children, 1, memory_order_relaxed);
+                (void)h2o_nif_port_release(parent);
+                (void)h2o_nif_port_release(port);
+            }
         }
     }
     // Close all children, if present
@@ -195,25 +272,29 @@ __h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out)
         h2o_nif_port_t *child = NULL;
         h2o_linklist_t garbage;
         int num_garbage = 0;
+        size_t shard;
         (void)h2o_linklist_init_anchor(&garbage);
-        (void)ck_spinlock_lock_eb(&h2o_nif_ports_spinlock);
-        anchor = &port->children;
-        node = anchor->next;
-        while (node != anchor) {
-            child = (h2o_nif_port_t *)node;
-            node = node->next;
-            (void)h2o_nif_port_keep(child); // Defer release until later
-            if (!h2o_nif_port_is_closed(child)) {
-                (void)h2o_linklist_unlink(&child->_link);
-                child->parent = NULL;
-                (void)h2o_linklist_insert(&garbage, &child->_link);
-                num_garbage++;
-            } else {
-                // Child already closing in progress by another thread, allow it to unlink itself
-                (void)h2o_nif_port_release(child);
+        for (shard = 0; shard != H2O_NIF_PORT_CHILD_SHARDS; ++shard) {
+            ck_spinlock_t *lock = h2o_nif_port_children_lock(port, shard);
+            (void)ck_spinlock_lock_eb(lock);
+            anchor = &port->children[shard];
+            node = anchor->next;
+            while (node != anchor) {
+                child = (h2o_nif_port_t *)node;
+                node = node->next;
+                (void)h2o_nif_port_keep(child); // Defer release until later
+                if (!h2o_nif_port_is_closed(child)) {
+                    (void)h2o_linklist_unlink(&child->_link);
+                    (void)ck_pr_store_ptr(&child->parent, NULL);
+                    (void)h2o_linklist_insert(&garbage, &child->_link);
+                    num_garbage++;
+                } else {
+                    // Child already closing in progress by another thread, allow it to unlink itself
+                    (void)h2o_nif_port_release(child);
+                }
             }
+            (void)ck_spinlock_unlock(lock);
         }
-        (void)ck_spinlock_unlock(&h2o_nif_ports_spinlock);
         (void)atomic_fetch_sub_explicit(&port->num_children, num_garbage, memory_order_relaxed);
         // TRACE_F("num_children=%d, num_garbage=%d\n", atomic_load_explicit(&port->num_children, memory_order_relaxed),
         // num_garbage);
@@ -236,3 +317,98 @@ __h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out)
     }
     return 1;
 }
+
+int
+h2o_nif_port_get_stats(ErlNifEnv *env, ERL_NIF_TERM *out)
+{
+    assert(out != NULL);
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    int type = H2O_NIF_PORT_NUM_TYPES;
+    /* H2O_NIF_PORT_TYPE_NONE is skipped, every port gets its type when opened */
+    while (--type > H2O_NIF_PORT_TYPE_NONE) {
+        uint64_t opened = 0;
+        uint64_t closed = 0;
+        uint64_t destroyed = 0;
+        uint64_t leaked = 0;
+        int64_t queued = 0;
+        size_t shard;
+        for (shard = 0; shard != H2O_NIF_PORT_STATS_SHARDS; ++shard) {
+            h2o_nif_port_stats_t *stats = &h2o_nif_ports_stats[shard].types[type];
+            opened += atomic_load_explicit(&stats->opened, memory_order_relaxed);
+            closed += atomic_load_explicit(&stats->closed, memory_order_relaxed);
+            destroyed += atomic_load_explicit(&stats->destroyed, memory_order_relaxed);
+            leaked += atomic_load_explicit(&stats->leaked, memory_order_relaxed);
+            queued += atomic_load_explicit(&stats->queued, memory_order_relaxed);
+        }
+        ERL_NIF_TERM items[5];
+        int i = 0;
+#define STAT(Id, Value) items[i++] = enif_make_tuple2(env, Id, enif_make_uint64(env, (ErlNifUInt64)(Value)))
+        /* read apart from each other, so clamp rather than report a wrapped count */
+        STAT(ATOM_live, (opened > destroyed) ? (opened - destroyed) : 0);
+        STAT(ATOM_opened, opened);
+        STAT(ATOM_closed, closed);
+        STAT(ATOM_leaked, leaked);
+#undef STAT
+        if (type == H2O_NIF_PORT_TYPE_FILTER || type == H2O_NIF_PORT_TYPE_HANDLER || type == H2O_NIF_PORT_TYPE_LOGGER) {
+            items[i++] = enif_make_tuple2(env, ATOM_queued, enif_make_uint64(env, (ErlNifUInt64)((queued > 0) ? queued : 0)));
+        }
+        ERL_NIF_TERM item = enif_make_tuple2(env, h2o_nif_port_type_to_atom(type), enif_make_list_from_array(env, items, i));
+        list = enif_make_list_cell(env, item, list);
+    }
+    *out = list;
+    return 1;
+}
+
+h2o_nif_port_stats_shard_t *
+h2o_nif_port_stats_attach(void)
+{
+    /* schedulers and loop threads are handed out shards in turn, each keeps its own for good */
+    size_t i = atomic_fetch_add_explicit(&port_stats_next_shard, 1, memory_order_relaxed) % H2O_NIF_PORT_STATS_SHARDS;
+    h2o_nif_ports_stats_shard = &h2o_nif_ports_stats[i];
+    return h2o_nif_ports_stats_shard;
+}
+
+int
+h2o_nif_port_monitor_owner(h2o_nif_port_t *port, ErlNifEnv *env)
+{
+    ErlNifPid owner = h2o_nif_port_get_owner(port);
+    int retval = 0;
+    (void)ck_spinlock_lock_eb(&port->monitor.lock);
+    if (port->monitor.active) {
+        (void)port_demonitor(port, env);
+    }
+    /* checked under the lock: either the close sees this monitor or the port is seen closed here */
+    if (!h2o_nif_port_is_closed(port)) {
+        retval = enif_monitor_process(env, port, &owner, &port->monitor.monitor);
+        port->monitor.active = (retval == 0);
+    }
+    (void)ck_spinlock_unlock(&port->monitor.lock);
+    if (retval > 0) {
+        /* the new owner is already gone */
+        (void)h2o_nif_port_close_silent(port, env, NULL);
+        return 0;
+    }
+    return (retval == 0);
+}
+
+static void
+port_demonitor(h2o_nif_port_t *port, ErlNifEnv *env)
+{
+    /* called with the monitor lock held */
+    if (enif_demonitor_process(env, port, &port->monitor.monitor) != 0) {
+        /* the monitor fired already: its callback is on its way and must not find the port freed */
+        port->monitor.pending++;
+        (void)h2o_nif_port_keep(port);
+    }
+    port->monitor.active = 0;
+}
+
+static void
+port_demonitor_owner(h2o_nif_port_t *port, ErlNifEnv *env)
+{
+    (void)ck_spinlock_lock_eb(&port->monitor.lock);
+    if (port->monitor.active) {
+        (void)port_demonitor(port, env);
+    }
+    (void)ck_spinlock_unlock(&port->monitor.lock);
+}
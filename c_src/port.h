@@ -5,6 +5,7 @@
 #define H2O_NIF_PORT_H
 
 #include "globals.h"
+#include "env.h"
 
 #define H2O_NIF_PORT_FLAG_ALC 0x0001
 #define H2O_NIF_PORT_FLAG_OPN 0x0002
@@ -33,15 +34,61 @@
 #define H2O_NIF_PORT_TYPE_REQUEST 5
 #define H2O_NIF_PORT_TYPE_FILTER_EVENT 6
 #define H2O_NIF_PORT_TYPE_HANDLER_EVENT 7
+#define H2O_NIF_PORT_NUM_TYPES 8
 
-/* Variables */
+/*
+ * The children of a port are spread over this many lists by the address of the child, so the events of one handler opened and
+ * closed by different threads rarely meet on the same lock.
+ */
+#define H2O_NIF_PORT_CHILD_SHARDS 4
 
-extern ck_spinlock_t h2o_nif_ports_spinlock;
-extern ErlNifResourceType *h2o_nif_port_resource_type;
+/* Locks guarding the children lists (and the `parent` field of the children on them), picked by parent and shard. */
+#define H2O_NIF_PORT_NUM_LOCKS 64
+
+/* Port counters are spread over this many shards, every thread updating the one it was given on first use. */
+#define H2O_NIF_PORT_STATS_SHARDS 64
 
 /* Types */
 
 typedef struct h2o_nif_port_s h2o_nif_port_t;
+typedef struct h2o_nif_port_lock_s h2o_nif_port_lock_t;
+typedef struct h2o_nif_port_stats_s h2o_nif_port_stats_t;
+typedef struct h2o_nif_port_stats_shard_s h2o_nif_port_stats_shard_t;
+
+struct h2o_nif_port_lock_s {
+    ck_spinlock_t lock;
+    /* unused buffer exists to avoid false sharing of the cache line (and the adjacent line fetched by the prefetcher) */
+    char _unused_avoid_false_sharing[128 - sizeof(ck_spinlock_t)];
+};
+
+/*
+ * Counters of one port type, updated with relaxed atomics on open, close and destruction.  A port is destroyed once the resource
+ * destructor ran, so `opened - destroyed` ports are alive.
+ */
+struct h2o_nif_port_stats_s {
+    _Atomic uint64_t opened;
+    _Atomic uint64_t closed;
+    _Atomic uint64_t destroyed;
+    _Atomic uint64_t leaked; /* reached the resource destructor without being closed */
+    _Atomic int64_t queued;  /* events waiting to be read from the ports of this type, a shard alone may go negative */
+};
+
+/*
+ * The counters of every type updated by the threads given this shard, summed by `h2o_nif_port_get_stats`.  Shards only meet when
+ * more threads than shards touch ports, so the atomics stay uncontended in practice.
+ */
+struct h2o_nif_port_stats_shard_s {
+    h2o_nif_port_stats_t types[H2O_NIF_PORT_NUM_TYPES];
+    /* unused buffer exists to avoid false sharing of the cache line (and the adjacent line fetched by the prefetcher) */
+    char _unused_avoid_false_sharing[128 - ((H2O_NIF_PORT_NUM_TYPES * sizeof(h2o_nif_port_stats_t)) % 128)];
+};
+
+/* Variables */
+
+extern h2o_nif_port_lock_t h2o_nif_ports_locks[H2O_NIF_PORT_NUM_LOCKS];
+extern h2o_nif_port_stats_shard_t h2o_nif_ports_stats[H2O_NIF_PORT_STATS_SHARDS];
+extern _Thread_local h2o_nif_port_stats_shard_t *h2o_nif_ports_stats_shard;
+extern ErlNifResourceType *h2o_nif_port_resource_type;
 
 typedef ERL_NIF_TERM h2o_nif_port_on_close_t(ErlNifEnv *env, h2o_nif_port_t *port, int is_direct_call);
 typedef void h2o_nif_port_on_dtor_t(ErlNifEnv *env, h2o_nif_port_t *port);
@@ -50,8 +97,8 @@ struct h2o_nif_port_s {
     h2o_linklist_t _link;
     _Atomic int state;
     _Atomic ErlNifPid owner;
-    h2o_nif_port_t *parent;
-    h2o_linklist_t children;
+    h2o_nif_port_t *parent; /* written under the lock of the children list, read with ck_pr_load_ptr() elsewhere */
+    h2o_linklist_t children[H2O_NIF_PORT_CHILD_SHARDS];
     _Atomic int num_children;
     struct {
         int state;
@@ -61,6 +108,13 @@ struct h2o_nif_port_s {
     } on_close;
     h2o_nif_port_on_dtor_t *dtor;
     int type;
+    /* process monitor on the owner set by `h2o_nif_port_monitor_owner`, its death closes the port */
+    struct {
+        ck_spinlock_t lock;
+        int active;
+        int pending; /* monitors that fired before they could be removed, each holds a reference until its callback ran */
+        ErlNifMonitor monitor;
+    } monitor;
 };
 
 /* NIF Functions */
@@ -73,6 +127,7 @@ extern void h2o_nif_port_unload(ErlNifEnv *env, h2o_nif_data_t *nif_data);
 
 extern h2o_nif_port_t *h2o_nif_port_alloc(size_t size);
 extern void h2o_nif_port_dtor(ErlNifEnv *env, void *obj);
+extern void h2o_nif_port_down(ErlNifEnv *env, void *obj, ErlNifPid *pid, ErlNifMonitor *mon);
 static int h2o_nif_port_get(ErlNifEnv *env, ERL_NIF_TERM port_term, h2o_nif_port_t **portp);
 static void h2o_nif_port_keep(h2o_nif_port_t *port);
 static ERL_NIF_TERM h2o_nif_port_make(ErlNifEnv *env, h2o_nif_port_t *port);
@@ -109,12 +164,53 @@ h2o_nif_port_release(h2o_nif_port_t *port)
     (void)enif_release_resource((void *)port);
 }
 
+/* Children Functions */
+
+static size_t h2o_nif_port_child_shard(h2o_nif_port_t *child);
+static ck_spinlock_t *h2o_nif_port_children_lock(h2o_nif_port_t *parent, size_t shard);
+static ERL_NIF_TERM h2o_nif_port_make_parent(ErlNifEnv *env, h2o_nif_port_t *port);
+
+inline size_t
+h2o_nif_port_child_shard(h2o_nif_port_t *child)
+{
+    return (size_t)(((uintptr_t)child >> 6) % H2O_NIF_PORT_CHILD_SHARDS);
+}
+
+inline ck_spinlock_t *
+h2o_nif_port_children_lock(h2o_nif_port_t *parent, size_t shard)
+{
+    /*
+     * Only the address of the parent is used: a child may look up the lock of a parent that was closed and freed meanwhile,
+     * and then finds its `parent` field cleared once it holds the lock.  The shards of one parent get distinct locks.
+     */
+    return &h2o_nif_ports_locks[((((uintptr_t)parent >> 6) * H2O_NIF_PORT_CHILD_SHARDS) + shard) % H2O_NIF_PORT_NUM_LOCKS].lock;
+}
+
+inline ERL_NIF_TERM
+h2o_nif_port_make_parent(ErlNifEnv *env, h2o_nif_port_t *port)
+{
+    /* the parent is only safe to reference while `port` is still on one of its children lists */
+    h2o_nif_port_t *parent = ck_pr_load_ptr(&port->parent);
+    ERL_NIF_TERM out = ATOM_undefined;
+    if (parent == NULL) {
+        return out;
+    }
+    ck_spinlock_t *lock = h2o_nif_port_children_lock(parent, h2o_nif_port_child_shard(port));
+    (void)ck_spinlock_lock_eb(lock);
+    if (port->parent == parent) {
+        out = h2o_nif_port_make(env, parent);
+    }
+    (void)ck_spinlock_unlock(lock);
+    return out;
+}
+
 /* Port Functions */
 
-extern int h2o_nif_port_open(h2o_nif_port_t *parent, size_t size, h2o_nif_port_t **portp);
+extern int h2o_nif_port_open(h2o_nif_port_t *parent, int type, size_t size, h2o_nif_port_t **portp);
 extern int h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out);
 extern int h2o_nif_port_close_silent(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out);
 extern int __h2o_nif_port_close(h2o_nif_port_t *port, ErlNifEnv *env, ERL_NIF_TERM *out);
+extern int h2o_nif_port_monitor_owner(h2o_nif_port_t *port, ErlNifEnv *env);
 static void h2o_nif_port_connect(h2o_nif_port_t *port, ErlNifEnv *env, ErlNifPid new_owner);
 static ErlNifPid h2o_nif_port_get_owner(h2o_nif_port_t *port);
 static void h2o_nif_port_set_owner(h2o_nif_port_t *port, ErlNifPid new_owner);
@@ -124,16 +220,16 @@ inline void
 h2o_nif_port_connect(h2o_nif_port_t *port, ErlNifEnv *env, ErlNifPid new_owner)
 {
     (void)h2o_nif_port_set_owner(port, new_owner);
-    if (atomic_load_explicit(&port->state, memory_order_relaxed) == H2O_NIF_PORT_STATE_CLOSED) {
-        if (((port->on_close.state & H2O_NIF_PORT_STATE_OPEN) == H2O_NIF_PORT_STATE_OPEN) && !port->on_close.silent) {
-            ErlNifEnv *msg_env = (env != NULL) ? env : enif_alloc_env();
-            ERL_NIF_TERM msg = enif_make_tuple2(msg_env, ATOM_h2o_port_closed, h2o_nif_port_make(msg_env, port));
-            if (env != NULL) {
-                (void)h2o_nif_port_send(msg_env, port, NULL, msg);
-            } else {
-                (void)h2o_nif_port_send(NULL, port, msg_env, msg);
-                (void)enif_free_env(msg_env);
-            }
+    if (atomic_load_explicit(&port->state, memory_order_relaxed) != H2O_NIF_PORT_STATE_CLOSED) {
+        (void)h2o_nif_port_monitor_owner(port, env);
+    } else if (((port->on_close.state & H2O_NIF_PORT_STATE_OPEN) == H2O_NIF_PORT_STATE_OPEN) && !port->on_close.silent) {
+        ErlNifEnv *msg_env = (env != NULL) ? env : h2o_nif_env_acquire();
+        ERL_NIF_TERM msg = enif_make_tuple2(msg_env, ATOM_h2o_port_closed, h2o_nif_port_make(msg_env, port));
+        if (env != NULL) {
+            (void)h2o_nif_port_send(msg_env, port, NULL, msg);
+        } else {
+            (void)h2o_nif_port_send(NULL, port, msg_env, msg);
+            (void)h2o_nif_env_release(msg_env);
         }
     }
 }
@@ -157,6 +253,60 @@ h2o_nif_port_send(ErlNifEnv *env, h2o_nif_port_t *port, ErlNifEnv *msg_env, ERL_
     return enif_send(env, &owner, msg_env, msg);
 }
 
+/* Stats Functions */
+
+extern int h2o_nif_port_get_stats(ErlNifEnv *env, ERL_NIF_TERM *out);
+extern h2o_nif_port_stats_shard_t *h2o_nif_port_stats_attach(void);
+static h2o_nif_port_stats_t *h2o_nif_port_stats(int type);
+static void h2o_nif_port_stats_enqueued(h2o_nif_port_t *port, unsigned long count);
+static void h2o_nif_port_stats_dequeued(h2o_nif_port_t *port, unsigned long count);
+static ERL_NIF_TERM h2o_nif_port_type_to_atom(int type);
+
+inline h2o_nif_port_stats_t *
+h2o_nif_port_stats(int type)
+{
+    h2o_nif_port_stats_shard_t *shard = h2o_nif_ports_stats_shard;
+    if (shard == NULL) {
+        shard = h2o_nif_port_stats_attach();
+    }
+    return &shard->types[type];
+}
+
+inline void
+h2o_nif_port_stats_enqueued(h2o_nif_port_t *port, unsigned long count)
+{
+    (void)atomic_fetch_add_explicit(&h2o_nif_port_stats(port->type)->queued, (int64_t)count, memory_order_relaxed);
+}
+
+inline void
+h2o_nif_port_stats_dequeued(h2o_nif_port_t *port, unsigned long count)
+{
+    (void)atomic_fetch_sub_explicit(&h2o_nif_port_stats(port->type)->queued, (int64_t)count, memory_order_relaxed);
+}
+
+inline ERL_NIF_TERM
+h2o_nif_port_type_to_atom(int type)
+{
+    switch (type) {
+    case H2O_NIF_PORT_TYPE_SERVER:
+        return ATOM_server;
+    case H2O_NIF_PORT_TYPE_FILTER:
+        return ATOM_filter;
+    case H2O_NIF_PORT_TYPE_HANDLER:
+        return ATOM_handler;
+    case H2O_NIF_PORT_TYPE_LOGGER:
+        return ATOM_logger;
+    case H2O_NIF_PORT_TYPE_REQUEST:
+        return ATOM_request;
+    case H2O_NIF_PORT_TYPE_FILTER_EVENT:
+        return ATOM_filter_event;
+    case H2O_NIF_PORT_TYPE_HANDLER_EVENT:
+        return ATOM_handler_event;
+    default:
+        return ATOM_undefined;
+    }
+}
+
 /* State Functions */
 
 static int h2o_nif_port_is_closed(h2o_nif_port_t *port);
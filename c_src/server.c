@@ -1,6 +1,10 @@
 // -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
 // vim: ts=4 sw=4 ft=c et
 
+#ifdef __linux__
+#define _GNU_SOURCE /* pthread_setaffinity_np(), CPU_SET() */
+#endif
+
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
@@ -13,6 +17,7 @@
 #include <netinet/tcp.h>
 #include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -20,6 +25,9 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -47,25 +55,27 @@
 
 static ERL_NIF_TERM h2o_nif_server_on_close(ErlNifEnv *env, h2o_nif_port_t *port, int is_direct_call);
 static void h2o_nif_server_dtor(ErlNifEnv *env, h2o_nif_port_t *port);
+static void stop_loops(h2o_nif_server_t *server);
 
 int
 h2o_nif_server_open(h2o_nif_server_t **serverp)
 {
     assert(serverp != NULL);
     h2o_nif_server_t *server = NULL;
-    if (!h2o_nif_port_open(NULL, sizeof(h2o_nif_server_t), (h2o_nif_port_t **)&server)) {
+    if (!h2o_nif_port_open(NULL, H2O_NIF_PORT_TYPE_SERVER, sizeof(h2o_nif_server_t), (h2o_nif_port_t **)&server)) {
         *serverp = NULL;
         return 0;
     }
     server->super.dtor = h2o_nif_server_dtor;
-    server->super.type = H2O_NIF_PORT_TYPE_SERVER;
     server->launch_time = time(NULL);
     server->threads = NULL;
+    (void)atomic_init(&server->num_threads, 0);
+    (void)atomic_init(&server->num_slots, 0);
     (void)atomic_init(&server->shutdown_requested, 0);
+    (void)atomic_init(&server->started_threads, 0);
     (void)atomic_init(&server->initialized_threads, 0);
     (void)atomic_init(&server->shutdown_threads, 0);
-    (void)atomic_init(&server->state._num_connections, 0);
-    (void)atomic_init(&server->state._num_sessions, 0);
+    (void)atomic_init(&server->state.listeners_paused, 0);
     if (!h2o_nif_config_init(&server->config)) {
         (void)h2o_nif_port_close(&server->super, NULL, NULL);
         *serverp = NULL;
@@ -83,8 +93,14 @@ h2o_nif_server_on_close(ErlNifEnv *env, h2o_nif_port_t *port, int is_direct_call
     TRACE_F("h2o_nif_server_on_close:%s:%d\n", __FILE__, __LINE__);
     assert(port->type == H2O_NIF_PORT_TYPE_SERVER);
     h2o_nif_server_t *server = (h2o_nif_server_t *)port;
-    (void)h2o_nif_config_dispose(&server->config);
-    (void)h2o_nif_port_release(&server->super);
+    if (server->threads == NULL) {
+        /* never started, no loop uses the config */
+        (void)h2o_nif_config_dispose(&server->config);
+        (void)h2o_nif_port_release(&server->super);
+        return ATOM_ok;
+    }
+    /* the loop detaching the last thread disposes of the server (see `server_dispose`) */
+    (void)stop_loops(server);
     return ATOM_ok;
 }
 
@@ -98,17 +114,56 @@ h2o_nif_server_dtor(ErlNifEnv *env, h2o_nif_port_t *port)
 
 /* Server Functions */
 
+typedef struct h2o_nif_srv_attach_s h2o_nif_srv_attach_t;
+
+struct h2o_nif_srv_attach_s {
+    h2o_nif_ipc_message_t super;
+    h2o_nif_srv_loop_t *loop;
+};
+
+static h2o_nif_srv_pool_t *pools = NULL;
+static h2o_nif_srv_pool_t *stopped_pools = NULL;
+
 static void *h2o_nif_server_run_loop(void *arg);
+static void busy_poll(h2o_nif_srv_loop_t *loop);
+static int compare_ready_owners(const void *a, const void *b);
 static void context_clear_timeout(h2o_loop_t *loop, h2o_timeout_t *timeout);
 static void context_clear_timeouts(h2o_context_t *ctx);
-static void notify_all_threads(h2o_nif_server_t *server);
-static int num_connections(h2o_nif_server_t *server, int delta);
-static unsigned long num_sessions(h2o_nif_server_t *server, int delta);
+static void flush_ready_input(h2o_nif_srv_loop_t *loop);
+static void loop_attach(h2o_nif_srv_loop_t *loop, h2o_nif_srv_thread_t *thread);
+static void loop_attach_pending(h2o_nif_srv_loop_t *loop);
+static void loop_end_pass(h2o_nif_srv_loop_t *loop);
+static void loop_prepare_pass(h2o_nif_srv_loop_t *loop);
+static uint64_t loop_woke_at(h2o_nif_srv_loop_t *loop);
+static void notify_least_loaded_threads(h2o_nif_srv_thread_t *self);
+static int num_connections(h2o_nif_server_t *server);
+static int num_threads_settled(h2o_nif_server_t *server);
+static h2o_nif_srv_pool_t *pool_acquire(h2o_nif_config_t *config);
+static h2o_nif_srv_pool_t *pool_create(const char *name, h2o_nif_config_t *config);
+static void pool_dispose(h2o_nif_srv_pool_t *pool);
+static int pool_exited(h2o_nif_srv_pool_t *pool);
+static void pool_free(h2o_nif_srv_pool_t *pool);
+static h2o_nif_srv_loop_t *pool_start_loop(h2o_nif_srv_pool_t *pool, size_t idx);
+static void pool_take_retired(h2o_nif_srv_pool_t *pool, h2o_nif_srv_loop_t ***loopsp, size_t *num_loopsp);
+static void pools_reap(void);
+static void thread_accept(h2o_nif_srv_listen_t *ctx, h2o_socket_t *sock);
+static size_t thread_accept_batch(h2o_nif_srv_thread_t *thread);
+static void thread_attach(h2o_nif_srv_thread_t *thread);
+static int thread_can_accept(h2o_nif_srv_thread_t *thread, int refresh);
+static void thread_detach(h2o_nif_srv_thread_t *thread);
+static h2o_nif_srv_thread_t *thread_init(h2o_nif_server_t *server, size_t idx, h2o_nif_srv_loop_t *loop);
+static void thread_num_connections(h2o_nif_srv_thread_t *thread, int delta);
+static void thread_shutdown(h2o_nif_srv_thread_t *thread);
 static void on_accept(h2o_socket_t *listener, const char *err);
+static void on_attach(h2o_nif_ipc_message_t *message);
 // static void on_erlang(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages);
 static void on_server_notification(h2o_multithread_receiver_t *receiver, h2o_linklist_t *messages);
 static void on_socketclose(void *data);
+static void record_loop_pass(h2o_nif_srv_loop_t *loop, uint64_t woke_usec);
+static void server_dispose(h2o_nif_server_t *server);
+static void set_busy_poll(int fd, uint64_t usec);
 static void set_cloexec(int fd);
+static void set_thread_placement(h2o_nif_srv_loop_t *loop);
 static void update_listener_state(h2o_nif_srv_listen_t *listeners);
 
 int
@@ -147,65 +202,857 @@ h2o_nif_server_start(h2o_nif_server_t *server)
     //              }
     //          }
 
-    // { /* initialize SSL_CTXs for session resumption and ticket-based resumption (also starts memcached client threads for the
-    // purpose) */
-    //  size_t i;
-    //  size_t j;
-    //  H2O_VECTOR(SSL_CTX *) ssl_contexts = {NULL};
-    //  for (i = 0; i != config->num_listeners; ++i) {
-    //      for (j = 0; j != config->listeners[i]->ssl.size; ++j) {
-    //          (void) h2o_vector_reserve(NULL, &ssl_contexts, ssl_contexts.size + 1);
-    //          ssl_contexts.entries[ssl_contexts.size++] = conf.listeners[i]->ssl.entries[j]->ctx;
-    //      }
-    //  }
-    //  (void) ssl_setup_session_resumption(ssl_contexts.entries, ssl_contexts.size);
-    //  (void) free(ssl_contexts.entries);
-    // }
+    { /* initialize SSL_CTXs for session resumption and ticket-based resumption */
+        size_t i;
+        size_t j;
+        H2O_VECTOR(SSL_CTX *) ssl_contexts = {NULL};
+        for (i = 0; i != config->num_listeners; ++i) {
+            for (j = 0; j != config->listeners[i]->ssl.size; ++j) {
+                (void)h2o_vector_reserve(NULL, &ssl_contexts, ssl_contexts.size + 1);
+                ssl_contexts.entries[ssl_contexts.size++] = config->listeners[i]->ssl.entries[j]->ctx;
+            }
+        }
+        if (ssl_contexts.size != 0 &&
+            !h2o_nif_ssl_setup_session_resumption(&config->ssl_resumption, ssl_contexts.entries, ssl_contexts.size)) {
+            (void)fprintf(stderr, "[warning] failed to setup ssl session resumption\n");
+        }
+        (void)free(ssl_contexts.entries);
+    }
+
+    /* prebuild the per-host terms of request events */
+    if (!h2o_nif_config_build_terms(config)) {
+        (void)fprintf(stderr, "[warning] failed to prebuild request terms, building them per request\n");
+    }
 
     /* all setup should be complete by now */
 
     assert(config->num_threads != 0);
 
-    /* start the threads */
-    server->threads = enif_alloc(sizeof(server->threads[0]) * config->num_threads);
-    (void)memset(server->threads, 0, sizeof(server->threads[0]) * config->num_threads);
+    /* private pools of servers closed since, whose loop threads returned by now */
+    (void)pools_reap();
+
+    /* start the loops, or find the shared ones: a server runs one thread on each loop of its pool */
+    h2o_nif_srv_pool_t *pool = pool_acquire(config);
+    if (pool == NULL) {
+        return 0;
+    }
+    if (pool->num_loops != config->num_threads) {
+        (void)fprintf(stderr, "[warning] loop-pool %s runs %zu threads, ignoring num-threads %zu\n", pool->name, pool->num_loops,
+                      config->num_threads);
+        config->num_threads = pool->num_loops;
+    }
+
+    /* open the per-thread sockets of `reuseport` listeners now that the number of threads is final */
+    (void)h2o_nif_config_open_reuseport_listeners(config);
+
+    /* hand the threads over to the loops */
+    server->threads = enif_alloc(sizeof(server->threads[0]) * H2O_NIF_CONFIG_MAX_THREADS);
+    (void)memset(server->threads, 0, sizeof(server->threads[0]) * H2O_NIF_CONFIG_MAX_THREADS);
     size_t i;
-    char name[32];
     for (i = 0; i != config->num_threads; ++i) {
-        h2o_nif_srv_thread_t *thread = &server->threads[i];
-        thread->server = server;
-        thread->idx = i;
-        (void)snprintf(name, sizeof(name), "h2o_nif_srv_%zu", i);
-        (void)enif_thread_create(name, &thread->tid, h2o_nif_server_run_loop, (void *)thread, NULL);
+        (void)thread_init(server, i, pool->loops[i]);
+    }
+    (void)atomic_store_explicit(&server->num_slots, config->num_threads, memory_order_release);
+    (void)atomic_store_explicit(&server->started_threads, config->num_threads, memory_order_relaxed);
+    (void)atomic_store_explicit(&server->num_threads, config->num_threads, memory_order_release);
+    for (i = 0; i != config->num_threads; ++i) {
+        (void)loop_attach(server->threads[i]->loop, server->threads[i]);
     }
 
     return 1;
 }
 
+int
+h2o_nif_server_set_threads(h2o_nif_server_t *server, size_t num_threads, ERL_NIF_TERM *reason)
+{
+    /*
+     * Threads are added or retired from the top, so thread `i` always owns reuseport socket `i` (see
+     * `h2o_nif_config_resize_reuseport_listeners`).  New threads start with no connection and the adaptive accept batch leans
+     * new connections towards them; retired threads accept what is left in their queues, close their listeners and stay attached
+     * until their last connection is gone.  Only one resize is in flight: another one is refused until every thread of the
+     * previous one got attached or detached.
+     */
+    assert(num_threads != 0 && num_threads <= H2O_NIF_CONFIG_MAX_THREADS);
+    h2o_nif_config_t *config = &server->config;
+    h2o_nif_srv_loop_t **exited = NULL;
+    size_t num_exited = 0;
+    size_t old_num_threads;
+    size_t i;
+    /* `server_dispose` frees the threads under `h2o_nif_mutex` once a closed server is gone */
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    if (atomic_load_explicit(&server->shutdown_requested, memory_order_relaxed)) {
+        (void)enif_mutex_unlock(h2o_nif_mutex);
+        *reason = ATOM_closed;
+        return 0;
+    }
+    if (server->threads == NULL) {
+        /* `h2o_nif_server_start` failed to get loops */
+        (void)enif_mutex_unlock(h2o_nif_mutex);
+        *reason = ATOM_not_started;
+        return 0;
+    }
+    h2o_nif_srv_pool_t *pool = server->threads[0]->loop->pool;
+    if (pool->name != NULL) {
+        /* the loops of a shared pool are not the server's to start or stop */
+        (void)enif_mutex_unlock(h2o_nif_mutex);
+        *reason = ATOM_loop_pool;
+        return 0;
+    }
+    old_num_threads = atomic_load_explicit(&server->num_threads, memory_order_relaxed);
+    if (!num_threads_settled(server)) {
+        (void)enif_mutex_unlock(h2o_nif_mutex);
+        *reason = ATOM_busy;
+        return 0;
+    }
+    if (num_threads > old_num_threads) {
+        config->num_threads = num_threads;
+        if (!h2o_nif_config_resize_reuseport_listeners(config, old_num_threads)) {
+            config->num_threads = old_num_threads;
+            (void)enif_mutex_unlock(h2o_nif_mutex);
+            *reason = ATOM_reuseport;
+            return 0;
+        }
+        for (i = old_num_threads; i != num_threads; ++i) {
+            (void)thread_init(server, i, pool_start_loop(pool, i));
+        }
+        pool->num_loops = num_threads;
+        if (num_threads > atomic_load_explicit(&server->num_slots, memory_order_relaxed)) {
+            (void)atomic_store_explicit(&server->num_slots, num_threads, memory_order_release);
+        }
+        (void)atomic_fetch_add_explicit(&server->started_threads, num_threads - old_num_threads, memory_order_relaxed);
+        (void)atomic_store_explicit(&server->num_threads, num_threads, memory_order_release);
+        for (i = old_num_threads; i != num_threads; ++i) {
+            (void)loop_attach(server->threads[i]->loop, server->threads[i]);
+        }
+    } else if (num_threads < old_num_threads) {
+        /* stop steering connections to the retired threads before they close their sockets */
+        config->num_threads = num_threads;
+        (void)atomic_store_explicit(&server->num_threads, num_threads, memory_order_release);
+        (void)h2o_nif_config_resize_reuseport_listeners(config, old_num_threads);
+        pool->num_loops = num_threads;
+        for (i = num_threads; i != old_num_threads; ++i) {
+            h2o_nif_srv_thread_t *thread = server->threads[i];
+            (void)atomic_store_explicit(&thread->retire, 1, memory_order_relaxed);
+            (void)h2o_multithread_send_message(&thread->server_notifications, NULL);
+        }
+    }
+    /* loops retired by an earlier resize whose thread is gone by now, joined once the pool may go away again */
+    (void)pool_take_retired(pool, &exited, &num_exited);
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    for (i = 0; i != num_exited; ++i) {
+        (void)enif_thread_join(exited[i]->tid, NULL);
+        (void)enif_free(exited[i]);
+    }
+    (void)free(exited);
+    (void)pools_reap();
+    return 1;
+}
+
+int
+h2o_nif_server_get_stats(h2o_nif_server_t *server, ErlNifEnv *env, ERL_NIF_TERM *out)
+{
+    assert(out != NULL);
+    ERL_NIF_TERM list = enif_make_list(env, 0);
+    size_t i;
+    /* a closed server may be disposed of by its last loop meanwhile (see `server_dispose`) */
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    if (server->threads == NULL) {
+        (void)enif_mutex_unlock(h2o_nif_mutex);
+        *out = list;
+        return 1;
+    }
+    i = atomic_load_explicit(&server->num_threads, memory_order_acquire);
+    while (i-- > 0) {
+        h2o_nif_srv_thread_t *thread = server->threads[i];
+        ERL_NIF_TERM ipc[6];
+        ERL_NIF_TERM ssl[3];
+        int j = 0;
+        int k = 0;
+        /* ipc */
+        {
+            h2o_nif_ipc_stats_t *stats = &thread->loop->ipc_stats;
+#define STAT(Id, Value) ipc[j++] = enif_make_tuple2(env, Id, enif_make_uint64(env, (ErlNifUInt64)(Value)))
+            STAT(ATOM_wakeups_sent, atomic_load_explicit(&stats->wakeups_sent, memory_order_relaxed));
+            uint64_t wakeups_received = atomic_load_explicit(&stats->wakeups_received, memory_order_relaxed);
+            uint64_t messages_drained = atomic_load_explicit(&stats->messages_drained, memory_order_relaxed);
+            /* every drained message beyond the first of a wakeup was enqueued without one */
+            STAT(ATOM_wakeups_suppressed, (messages_drained > wakeups_received) ? messages_drained - wakeups_received : 0);
+            STAT(ATOM_wakeups_received, wakeups_received);
+            STAT(ATOM_messages_drained, messages_drained);
+            STAT(ATOM_max_drained, atomic_load_explicit(&stats->max_drained, memory_order_relaxed));
+            STAT(ATOM_budget_exhausted, atomic_load_explicit(&stats->budget_exhausted, memory_order_relaxed));
+#undef STAT
+        }
+        /* ssl */
+        {
+            h2o_nif_ssl_stats_t *stats = &thread->loop->ssl_stats;
+#define STAT(Id, Value) ssl[k++] = enif_make_tuple2(env, Id, enif_make_uint64(env, (ErlNifUInt64)(Value)))
+            STAT(ATOM_full_handshakes, atomic_load_explicit(&stats->full_handshakes, memory_order_relaxed));
+            STAT(ATOM_resumptions, atomic_load_explicit(&stats->resumptions, memory_order_relaxed));
+            STAT(ATOM_ticket_resumptions, atomic_load_explicit(&stats->ticket_resumptions, memory_order_relaxed));
+#undef STAT
+        }
+        /* loop */
+        ERL_NIF_TERM loop[4];
+        loop[0] = enif_make_tuple2(env, ATOM_pass, h2o_nif_hist_make(env, &thread->loop->stats.pass_usec));
+        loop[1] = enif_make_tuple2(env, ATOM_ipc_drain, h2o_nif_hist_make(env, &thread->loop->ipc_stats.drain_usec));
+        loop[2] = enif_make_tuple2(env, ATOM_accept, h2o_nif_hist_make(env, &thread->accept_usec));
+        loop[3] = enif_make_tuple2(env, ATOM_watchdog, h2o_nif_watchdog_make(env, &thread->loop->stats.watchdog));
+        ERL_NIF_TERM item = enif_make_list3(env, enif_make_tuple2(env, ATOM_ipc, enif_make_list_from_array(env, ipc, j)),
+                                            enif_make_tuple2(env, ATOM_ssl, enif_make_list_from_array(env, ssl, k)),
+                                            enif_make_tuple2(env, ATOM_loop, enif_make_list_from_array(env, loop, 4)));
+        list = enif_make_list_cell(env, enif_make_tuple2(env, enif_make_uint64(env, thread->idx), item), list);
+    }
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    *out = list;
+    return 1;
+}
+
+void
+h2o_nif_server_ready_input(h2o_context_t *ctx, h2o_nif_port_t *port, atomic_flag *state)
+{
+    /*
+     * Called from the loop thread by the first request that finds `state` clear; the owner is told once the current pass is
+     * over, so a burst of requests accepted in one pass costs a single message per owning process.
+     */
+    h2o_nif_srv_loop_t *loop = ((h2o_nif_srv_thread_ctx_t *)ctx)->thread->loop;
+    (void)h2o_nif_port_keep(port);
+    (void)h2o_vector_reserve(NULL, &loop->ready.ports, loop->ready.ports.size + 1);
+    h2o_nif_srv_ready_t *entry = &loop->ready.ports.entries[loop->ready.ports.size++];
+    entry->port = port;
+    entry->state = state;
+}
+
 static void *
 h2o_nif_server_run_loop(void *arg)
 {
     // TRACE_F("h2o_drv_server_loop:%s:%d\n", __FILE__, __LINE__);
 
-    h2o_nif_srv_thread_t *thread = (h2o_nif_srv_thread_t *)arg;
-    if (thread == NULL) {
+    h2o_nif_srv_loop_t *loop = (h2o_nif_srv_loop_t *)arg;
+    if (loop == NULL) {
         return NULL;
     }
-    h2o_nif_server_t *server = thread->server;
-    if (server == NULL) {
+    h2o_nif_srv_pool_t *pool = loop->pool;
+    /* pin before allocating anything so the loop structures are first touched on the thread's own node */
+    (void)set_thread_placement(loop);
+
+    (void)h2o_nif_ssl_set_thread_stats(&loop->ssl_stats);
+    (void)h2o_nif_env_pool_init(&loop->envs);
+    (void)h2o_nif_env_pool_set_thread(&loop->envs);
+    (void)h2o_nif_hist_init(&loop->ipc_stats.drain_usec);
+    (void)h2o_nif_hist_init(&loop->stats.pass_usec);
+    (void)h2o_nif_watchdog_init(&loop->stats.watchdog, pool->config.loop_watchdog_usec);
+    loop->ipc_stats.time_callbacks = (pool->config.loop_watchdog_usec != 0);
+    loop->busy_poll.budget_usec = pool->config.busy_poll_usec;
+    loop->busy_poll.messages_drained = 0;
+    loop->ready.env = enif_alloc_env();
+    (void)memset(&loop->ready.ports, 0, sizeof(loop->ready.ports));
+
+    loop->loop = h2o_evloop_create();
+    loop->ipc_queue = h2o_nif_ipc_create_queue(loop->loop, &loop->ipc_stats, pool->config.ipc_budget_messages,
+                                               pool->config.ipc_budget_usec);
+    assert(loop->ipc_queue != NULL);
+
+    /* threads handed over from now on come with a wakeup, the ones queued meanwhile are attached right away */
+    (void)ck_spinlock_lock_eb(&loop->attach.lock);
+    loop->attach.queue = loop->ipc_queue;
+    (void)ck_spinlock_unlock(&loop->attach.lock);
+    (void)loop_attach_pending(loop);
+
+    /* the main loop */
+    while (1) {
+        (void)loop_prepare_pass(loop);
+        if (loop->exit) {
+            break;
+        }
+        if (pool->config.busy_poll_usec != 0) {
+            (void)busy_poll(loop);
+        }
+        /* run the loop once, without blocking while the IPC budget left messages behind */
+        int backlogged = h2o_nif_ipc_queue_is_backlogged(loop->ipc_queue);
+        uint64_t polled_at = h2o_nif_hist_now_usec();
+        loop->stats.woke_usec = 0;
+        loop->ipc_stats.woke_usec = 0;
+        (void)h2o_evloop_run(loop->loop, backlogged ? 0 : INT32_MAX);
+        (void)h2o_nif_ipc_resume(loop->ipc_queue);
+        (void)loop_end_pass(loop);
+        /* a zero-timeout poll did not wait, the whole pass was busy */
+        (void)record_loop_pass(loop, backlogged ? polled_at : loop_woke_at(loop));
+    }
+
+    /* every thread is detached, only a private pool gets here */
+    (void)flush_ready_input(loop);
+    (void)free(loop->ready.ports.entries);
+    (void)memset(&loop->ready.ports, 0, sizeof(loop->ready.ports));
+    (void)enif_free_env(loop->ready.env);
+    loop->ready.env = NULL;
+    (void)h2o_nif_env_pool_set_thread(NULL);
+    (void)h2o_nif_env_pool_dispose(&loop->envs);
+
+    (void)h2o_nif_ipc_destroy_queue(loop->ipc_queue);
+    loop->ipc_queue = NULL;
+    (void)h2o_nif_ipc_thread_exit();
+
+    /* destroy the loop */
+    (void)h2o_evloop_destroy(loop->loop);
+    loop->loop = NULL;
+
+    /* the pool is freed by whoever joins the last loop thread (see `pools_reap`), don't touch it past this point */
+    (void)atomic_store_explicit(&loop->exited, 1, memory_order_release);
+    return NULL;
+}
+
+static void
+busy_poll(h2o_nif_srv_loop_t *loop)
+{
+    /*
+     * Keep polling the IPC fifo and epoll with a zero timeout until the budget passes without an IPC message, then block as
+     * usual.  Producers skip the wakeup write while the thread spins (see `h2o_nif_ipc_spin_begin`), so a reply goes from the
+     * scheduler to the socket without a wakeup write or a blocking epoll.  A spin that found nothing halves the next budget, so
+     * an idle thread soon stops burning its core; any IPC message, spun for or woken up for, restores the full budget.
+     */
+    uint64_t busy_poll_usec = loop->pool->config.busy_poll_usec;
+    h2o_nif_ipc_queue_t *queue = loop->ipc_queue;
+    _Atomic uint64_t *drained = &loop->ipc_stats.messages_drained;
+    uint64_t seen = atomic_load_explicit(drained, memory_order_relaxed);
+    if (seen != loop->busy_poll.messages_drained) {
+        loop->busy_poll.budget_usec = busy_poll_usec;
+    }
+    uint64_t budget = loop->busy_poll.budget_usec;
+    if (budget == 0) {
+        loop->busy_poll.messages_drained = seen;
+        return;
+    }
+    uint64_t started = seen;
+    uint64_t deadline = h2o_nif_hist_now_usec() + budget;
+    (void)h2o_nif_ipc_spin_begin(queue);
+    while (!loop->exit) {
+        uint64_t spun_at = h2o_nif_hist_now_usec();
+        (void)h2o_nif_ipc_spin_poll(queue);
+        (void)h2o_evloop_run(loop->loop, 0);
+        (void)loop_end_pass(loop);
+        (void)record_loop_pass(loop, spun_at);
+        (void)loop_prepare_pass(loop);
+        uint64_t now = h2o_nif_hist_now_usec();
+        uint64_t current = atomic_load_explicit(drained, memory_order_relaxed);
+        if (current != seen) {
+            seen = current;
+            deadline = now + busy_poll_usec;
+        } else if (now >= deadline) {
+            break;
+        }
+    }
+    (void)h2o_nif_ipc_spin_end(queue);
+    loop->busy_poll.budget_usec = (seen != started) ? busy_poll_usec : budget / 2;
+    loop->busy_poll.messages_drained = atomic_load_explicit(drained, memory_order_relaxed);
+}
+
+static int
+compare_ready_owners(const void *a, const void *b)
+{
+    /* a local pid is an immediate term, so comparing it needs no environment */
+    return enif_compare(((const h2o_nif_srv_ready_t *)a)->owner.pid, ((const h2o_nif_srv_ready_t *)b)->owner.pid);
+}
+
+static void
+context_clear_timeout(h2o_loop_t *loop, h2o_timeout_t *timeout)
+{
+    while (!h2o_linklist_is_empty(&timeout->_entries)) {
+        // TRACE_F("there's a timeout entry\n");
+        h2o_timeout_entry_t *entry = H2O_STRUCT_FROM_MEMBER(h2o_timeout_entry_t, _link, timeout->_entries.next);
+        (void)h2o_linklist_unlink(&entry->_link);
+        entry->registered_at = 0;
+        entry->cb(entry);
+        (void)h2o_timeout__do_post_callback(loop);
+    }
+    return;
+}
+
+static void
+context_clear_timeouts(h2o_context_t *ctx)
+{
+    // TRACE_F("clear zero_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->zero_timeout);
+    // TRACE_F("clear one_sec_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->one_sec_timeout);
+    // TRACE_F("clear hundred_ms_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->hundred_ms_timeout);
+    // TRACE_F("clear handshake_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->handshake_timeout);
+    // TRACE_F("clear http1.req_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->http1.req_timeout);
+    // TRACE_F("clear http2.idle_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->http2.idle_timeout);
+    // TRACE_F("clear http2.graceful_shutdown_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->http2.graceful_shutdown_timeout);
+    // TRACE_F("clear proxy.io_timeout\n");
+    (void)context_clear_timeout(ctx->loop, &ctx->proxy.io_timeout);
+    return;
+}
+
+static void
+flush_ready_input(h2o_nif_srv_loop_t *loop)
+{
+    /*
+     * Entries are sorted by owner so that each group goes out as `{h2o_port_data, Port, ready_input}` for a single port or
+     * `{h2o_ports_data, Ports, ready_input}` otherwise.
+     */
+    ErlNifEnv *env = loop->ready.env;
+    h2o_nif_srv_ready_t *entries = loop->ready.ports.entries;
+    size_t size = loop->ready.ports.size;
+    size_t i = 0;
+    size_t j;
+    for (i = 0; i != size; ++i) {
+        entries[i].owner = h2o_nif_port_get_owner(entries[i].port);
+    }
+    if (size > 1) {
+        (void)qsort(entries, size, sizeof(entries[0]), compare_ready_owners);
+    }
+    i = 0;
+    while (i != size) {
+        ErlNifPid owner = entries[i].owner;
+        size_t n = 1;
+        while (i + n != size && enif_compare(entries[i + n].owner.pid, owner.pid) == 0) {
+            n++;
+        }
+        ERL_NIF_TERM msg;
+        if (n == 1) {
+            msg = enif_make_tuple3(env, ATOM_h2o_port_data, h2o_nif_port_make(env, entries[i].port), ATOM_ready_input);
+        } else {
+            ERL_NIF_TERM ports = enif_make_list(env, 0);
+            for (j = i + n; j-- != i;) {
+                ports = enif_make_list_cell(env, h2o_nif_port_make(env, entries[j].port), ports);
+            }
+            msg = enif_make_tuple3(env, ATOM_h2o_ports_data, ports, ATOM_ready_input);
+        }
+        int sent = enif_send(NULL, &owner, env, msg);
+        (void)enif_clear_env(env);
+        for (j = i; j != i + n; ++j) {
+            if (!sent) {
+                (void)atomic_flag_clear_explicit(entries[j].state, memory_order_relaxed);
+            }
+            (void)h2o_nif_port_release(entries[j].port);
+        }
+        i += n;
+    }
+    loop->ready.ports.size = 0;
+}
+
+static void
+loop_attach(h2o_nif_srv_loop_t *loop, h2o_nif_srv_thread_t *thread)
+{
+    /* called by `h2o_nif_server_start` on a scheduler, the loop thread sets up the context and listeners itself */
+    h2o_nif_ipc_queue_t *queue;
+    (void)ck_spinlock_lock_eb(&loop->attach.lock);
+    (void)h2o_linklist_insert(&loop->attach.threads, &thread->_link);
+    queue = loop->attach.queue;
+    (void)ck_spinlock_unlock(&loop->attach.lock);
+    if (queue == NULL) {
+        return;
+    }
+    h2o_nif_srv_attach_t *message = (void *)h2o_nif_ipc_create_message(sizeof(*message), on_attach, NULL);
+    if (message == NULL) {
+        perror("loop attach");
+        abort();
+    }
+    message->loop = loop;
+    (void)h2o_nif_ipc_enqueue(queue, (h2o_nif_ipc_message_t *)message);
+}
+
+static void
+loop_attach_pending(h2o_nif_srv_loop_t *loop)
+{
+    h2o_linklist_t pending;
+    (void)h2o_linklist_init_anchor(&pending);
+    (void)ck_spinlock_lock_eb(&loop->attach.lock);
+    (void)h2o_linklist_insert_list(&pending, &loop->attach.threads);
+    (void)ck_spinlock_unlock(&loop->attach.lock);
+    while (!h2o_linklist_is_empty(&pending)) {
+        h2o_nif_srv_thread_t *thread = H2O_STRUCT_FROM_MEMBER(h2o_nif_srv_thread_t, _link, pending.next);
+        (void)h2o_linklist_unlink(&thread->_link);
+        (void)thread_attach(thread);
+    }
+}
+
+static void
+loop_end_pass(h2o_nif_srv_loop_t *loop)
+{
+    h2o_linklist_t *node;
+    (void)flush_ready_input(loop);
+    for (node = loop->threads.next; node != &loop->threads; node = node->next) {
+        h2o_nif_srv_thread_t *thread = H2O_STRUCT_FROM_MEMBER(h2o_nif_srv_thread_t, _link, node);
+        (void)h2o_filecache_clear(thread->ctx.super.filecache);
+    }
+}
+
+static void
+loop_prepare_pass(h2o_nif_srv_loop_t *loop)
+{
+    /* resume or pause the listeners of every server, and take down the threads of servers shutting down */
+    h2o_linklist_t *node = loop->threads.next;
+    while (node != &loop->threads) {
+        h2o_nif_srv_thread_t *thread = H2O_STRUCT_FROM_MEMBER(h2o_nif_srv_thread_t, _link, node);
+        h2o_nif_server_t *server = thread->server;
+        node = node->next;
+        if (thread->shutting_down) {
+            /* wait until all the connections of the server get closed, or only its own for a retired thread */
+            int n = (thread->retiring) ? atomic_load_explicit(&thread->conns.num_connections, memory_order_relaxed)
+                                       : num_connections(server);
+            if (n == 0) {
+                (void)thread_detach(thread);
+            }
+        } else if (atomic_load_explicit(&server->shutdown_requested, memory_order_relaxed)) {
+            (void)thread_shutdown(thread);
+        } else if (atomic_load_explicit(&thread->retire, memory_order_relaxed)) {
+            thread->retiring = 1;
+            (void)thread_shutdown(thread);
+        } else {
+            (void)update_listener_state(thread->listeners);
+        }
+    }
+}
+
+static uint64_t
+loop_woke_at(h2o_nif_srv_loop_t *loop)
+{
+    /* the earliest of our wakeup callbacks, a pass woken up by a connection may run them later on */
+    uint64_t woke_usec = loop->stats.woke_usec;
+    uint64_t ipc_woke_usec = loop->ipc_stats.woke_usec;
+    if (ipc_woke_usec != 0 && (woke_usec == 0 || ipc_woke_usec < woke_usec)) {
+        woke_usec = ipc_woke_usec;
+    }
+    return woke_usec;
+}
+
+static void
+notify_least_loaded_threads(h2o_nif_srv_thread_t *self)
+{
+    /*
+     * Wake at most `max-connections-wakeups` paused threads, least loaded first.  The caller is skipped as it is running and
+     * rechecks its own listeners before the next loop pass.  Claiming a thread by clearing its `accept_paused` flag keeps
+     * concurrent closes from waking the same thread twice.
+     */
+    h2o_nif_server_t *server = self->server;
+    size_t num_wakeups = server->config.max_connections_wakeups;
+    while (num_wakeups-- > 0 && atomic_load_explicit(&server->state.listeners_paused, memory_order_relaxed) > 0) {
+        h2o_nif_srv_thread_t *target = NULL;
+        int target_connections = INT_MAX;
+        size_t n = atomic_load_explicit(&server->num_threads, memory_order_acquire);
+        size_t i;
+        for (i = 0; i != n; ++i) {
+            h2o_nif_srv_thread_t *thread = server->threads[i];
+            if (thread == self || !atomic_load_explicit(&thread->conns.accept_paused, memory_order_relaxed)) {
+                continue;
+            }
+            int num_connections = atomic_load_explicit(&thread->conns.num_connections, memory_order_relaxed);
+            if (num_connections < target_connections) {
+                target = thread;
+                target_connections = num_connections;
+            }
+        }
+        if (target == NULL) {
+            return;
+        }
+        int expected = 1;
+        if (atomic_compare_exchange_strong_explicit(&target->conns.accept_paused, &expected, 0, memory_order_relaxed,
+                                                    memory_order_relaxed)) {
+            (void)atomic_fetch_sub_explicit(&server->state.listeners_paused, 1, memory_order_relaxed);
+            (void)h2o_multithread_send_message(&target->server_notifications, NULL);
+        } else {
+            /* lost the race to another closing thread, pick again */
+            ++num_wakeups;
+        }
+    }
+}
+
+static int
+num_connections(h2o_nif_server_t *server)
+{
+    /* retired threads still draining count against `max-connections` */
+    size_t n = atomic_load_explicit(&server->num_slots, memory_order_acquire);
+    int total = 0;
+    size_t i;
+    for (i = 0; i != n; ++i) {
+        total += atomic_load_explicit(&server->threads[i]->conns.num_connections, memory_order_relaxed);
+    }
+    return total;
+}
+
+static int
+num_threads_settled(h2o_nif_server_t *server)
+{
+    /* every thread below `num_threads` is attached and every thread above it is detached */
+    size_t attached = atomic_load_explicit(&server->initialized_threads, memory_order_acquire) -
+                      atomic_load_explicit(&server->shutdown_threads, memory_order_acquire);
+    return (attached == atomic_load_explicit(&server->num_threads, memory_order_relaxed));
+}
+
+static h2o_nif_srv_pool_t *
+pool_acquire(h2o_nif_config_t *config)
+{
+    /* the first server starting with a `loop-pool` name creates the pool, later ones share it */
+    h2o_nif_srv_pool_t *pool = NULL;
+    if (config->loop_pool == NULL) {
+        return pool_create(NULL, config);
+    }
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    for (pool = pools; pool != NULL; pool = pool->next) {
+        if (strcmp(pool->name, config->loop_pool) == 0) {
+            break;
+        }
+    }
+    if (pool == NULL && (pool = pool_create(config->loop_pool, config)) != NULL) {
+        pool->next = pools;
+        pools = pool;
+    }
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    return pool;
+}
+
+static h2o_nif_srv_pool_t *
+pool_create(const char *name, h2o_nif_config_t *config)
+{
+    h2o_nif_srv_pool_t *pool = enif_alloc(sizeof(*pool));
+    if (pool == NULL) {
         return NULL;
     }
+    (void)memset(pool, 0, sizeof(*pool));
+    pool->name = (name != NULL) ? h2o_strdup(NULL, name, SIZE_MAX).base : NULL;
+    pool->num_loops = config->num_threads;
+    pool->num_slots = 0;
+    pool->loops = enif_alloc(sizeof(pool->loops[0]) * H2O_NIF_CONFIG_MAX_THREADS);
+    (void)memset(pool->loops, 0, sizeof(pool->loops[0]) * H2O_NIF_CONFIG_MAX_THREADS);
+    /* copied, the pool may outlive the server creating it */
+    size_t i;
+    pool->config.cpu_affinity = NULL;
+    pool->config.num_cpu_affinity = config->num_cpu_affinity;
+    if (config->num_cpu_affinity != 0) {
+        pool->config.cpu_affinity = enif_alloc(sizeof(pool->config.cpu_affinity[0]) * config->num_cpu_affinity);
+        for (i = 0; i != config->num_cpu_affinity; ++i) {
+            h2o_nif_cfg_cpus_t *cpus = &config->cpu_affinity[i];
+            pool->config.cpu_affinity[i].entries = enif_alloc(sizeof(cpus->entries[0]) * cpus->size);
+            (void)memcpy(pool->config.cpu_affinity[i].entries, cpus->entries, sizeof(cpus->entries[0]) * cpus->size);
+            pool->config.cpu_affinity[i].size = cpus->size;
+        }
+    }
+    pool->config.numa_local = config->numa_local;
+    pool->config.ipc_budget_messages = config->ipc_budget_messages;
+    pool->config.ipc_budget_usec = config->ipc_budget_usec;
+    pool->config.loop_watchdog_usec = config->loop_watchdog_usec;
+    pool->config.busy_poll_usec = config->busy_poll_usec;
+    for (i = 0; i != pool->num_loops; ++i) {
+        (void)pool_start_loop(pool, i);
+    }
+    return pool;
+}
+
+static void
+pool_dispose(h2o_nif_srv_pool_t *pool)
+{
+    /* every loop thread of the pool returned already (see `pool_exited`), joining them won't block */
+    size_t i;
+    for (i = 0; i != pool->num_slots; ++i) {
+        (void)enif_thread_join(pool->loops[i]->tid, NULL);
+    }
+    for (i = 0; i != pool->retired.size; ++i) {
+        (void)enif_thread_join(pool->retired.entries[i]->tid, NULL);
+    }
+    (void)pool_free(pool);
+}
+
+static int
+pool_exited(h2o_nif_srv_pool_t *pool)
+{
+    size_t i;
+    for (i = 0; i != pool->num_slots; ++i) {
+        if (!atomic_load_explicit(&pool->loops[i]->exited, memory_order_acquire)) {
+            return 0;
+        }
+    }
+    for (i = 0; i != pool->retired.size; ++i) {
+        if (!atomic_load_explicit(&pool->retired.entries[i]->exited, memory_order_acquire)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void
+pool_free(h2o_nif_srv_pool_t *pool)
+{
+    size_t i;
+    for (i = 0; i != pool->config.num_cpu_affinity; ++i) {
+        (void)enif_free(pool->config.cpu_affinity[i].entries);
+    }
+    if (pool->config.cpu_affinity != NULL) {
+        (void)enif_free(pool->config.cpu_affinity);
+    }
+    for (i = 0; i != pool->num_slots; ++i) {
+        (void)enif_free(pool->loops[i]);
+    }
+    for (i = 0; i != pool->retired.size; ++i) {
+        (void)enif_free(pool->retired.entries[i]);
+    }
+    (void)free(pool->retired.entries);
+    (void)enif_free(pool->loops);
+    (void)free(pool->name);
+    (void)enif_free(pool);
+}
+
+static h2o_nif_srv_loop_t *
+pool_start_loop(h2o_nif_srv_pool_t *pool, size_t idx)
+{
+    h2o_nif_srv_loop_t *loop;
+    char thread_name[32];
+    if (idx < pool->num_slots) {
+        /*
+         * Retired by an earlier resize: its last thread is detached and the loop thread is exiting, if not gone already.  It is
+         * joined later on (see `pool_take_retired`), not here under `h2o_nif_mutex`.
+         */
+        (void)h2o_vector_reserve(NULL, &pool->retired, pool->retired.size + 1);
+        pool->retired.entries[pool->retired.size++] = pool->loops[idx];
+        loop = enif_alloc(sizeof(*loop));
+        pool->loops[idx] = loop;
+    } else {
+        assert(idx == pool->num_slots);
+        loop = enif_alloc(sizeof(*loop));
+        pool->loops[pool->num_slots++] = loop;
+    }
+    (void)memset(loop, 0, sizeof(*loop));
+    loop->pool = pool;
+    loop->idx = idx;
+    (void)h2o_linklist_init_anchor(&loop->threads);
+    (void)ck_spinlock_init(&loop->attach.lock);
+    (void)h2o_linklist_init_anchor(&loop->attach.threads);
+    loop->attach.queue = NULL;
+    (void)atomic_init(&loop->exited, 0);
+    (void)snprintf(thread_name, sizeof(thread_name), "h2o_nif_srv_%zu", idx);
+    (void)enif_thread_create(thread_name, &loop->tid, h2o_nif_server_run_loop, (void *)loop, NULL);
+    return loop;
+}
+
+static void
+pool_take_retired(h2o_nif_srv_pool_t *pool, h2o_nif_srv_loop_t ***loopsp, size_t *num_loopsp)
+{
+    /*
+     * Called with `h2o_nif_mutex` held.  Only the loops whose thread already returned are taken, the others may still be
+     * draining connections; the caller joins and frees them once the mutex is released.
+     */
+    H2O_VECTOR(h2o_nif_srv_loop_t *) exited = {NULL};
+    size_t i;
+    size_t j = 0;
+    for (i = 0; i != pool->retired.size; ++i) {
+        h2o_nif_srv_loop_t *loop = pool->retired.entries[i];
+        if (atomic_load_explicit(&loop->exited, memory_order_acquire)) {
+            (void)h2o_vector_reserve(NULL, &exited, exited.size + 1);
+            exited.entries[exited.size++] = loop;
+        } else {
+            pool->retired.entries[j++] = loop;
+        }
+    }
+    pool->retired.size = j;
+    *loopsp = exited.entries;
+    *num_loopsp = exited.size;
+}
+
+static void
+pools_reap(void)
+{
+    /*
+     * Private pools are joined here rather than when their server is closed: a loop only exits once the last connection of its
+     * server is gone, which a keep-alive client may hold off for long, and closing runs on a scheduler.
+     */
+    h2o_nif_srv_pool_t *reaped = NULL;
+    h2o_nif_srv_pool_t **poolp;
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    poolp = &stopped_pools;
+    while (*poolp != NULL) {
+        h2o_nif_srv_pool_t *pool = *poolp;
+        if (pool_exited(pool)) {
+            *poolp = pool->next;
+            pool->next = reaped;
+            reaped = pool;
+        } else {
+            poolp = &pool->next;
+        }
+    }
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    while (reaped != NULL) {
+        h2o_nif_srv_pool_t *pool = reaped;
+        reaped = pool->next;
+        (void)pool_dispose(pool);
+    }
+}
+
+static void
+thread_accept(h2o_nif_srv_listen_t *ctx, h2o_socket_t *sock)
+{
+    (void)thread_num_connections(ctx->thread, 1);
+
+    sock->on_close.cb = on_socketclose;
+    sock->on_close.data = ctx;
+
+    (void)h2o_accept(&ctx->accept_ctx, sock);
+}
+
+static size_t
+thread_accept_batch(h2o_nif_srv_thread_t *thread)
+{
+    /*
+     * The batch starts from the old fixed size (`max_connections / 16 / num_threads`, at least 8) and is scaled by how loaded
+     * this thread is compared to the average: idle threads take up to twice as many, a thread at twice the average or more only
+     * takes one so the remaining connections stay in the accept queue for its siblings.  A lagging loop (callbacks already ran
+     * for several milliseconds this pass) or an IPC backlog shrinks it further.
+     */
+    h2o_nif_server_t *server = thread->server;
+    h2o_nif_config_t *config = &server->config;
+    size_t num_threads = atomic_load_explicit(&server->num_threads, memory_order_relaxed);
+    size_t base = config->max_connections / 16 / num_threads;
+    if (base < H2O_NIF_SRV_ACCEPT_MIN) {
+        base = H2O_NIF_SRV_ACCEPT_MIN;
+    }
+    size_t mine = (size_t)atomic_load_explicit(&thread->conns.num_connections, memory_order_relaxed);
+    int total = thread->conns.approx_total + thread->conns.since_refresh;
+    size_t avg = (total > 0) ? ((size_t)total / num_threads) : 0;
+    size_t batch;
+    if (mine >= 2 * avg && avg >= H2O_NIF_SRV_ACCEPT_MIN) {
+        return 1;
+    } else if (mine <= avg / 2) {
+        batch = base * 2;
+    } else if (mine <= avg) {
+        batch = base;
+    } else {
+        batch = base / 2;
+    }
+    struct timeval tv;
+    (void)gettimeofday(&tv, NULL);
+    uint64_t now = (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+    uint64_t polled_at = h2o_now(thread->ctx.super.loop);
+    if (now > polled_at && now - polled_at >= H2O_NIF_SRV_ACCEPT_LAG_MS) {
+        batch /= 4;
+    }
+    if (thread->loop->ipc_queue != NULL && h2o_nif_ipc_queue_is_backlogged(thread->loop->ipc_queue)) {
+        batch /= 2;
+    }
+    return (batch == 0) ? 1 : batch;
+}
+
+static void
+thread_attach(h2o_nif_srv_thread_t *thread)
+{
+    h2o_nif_srv_loop_t *loop = thread->loop;
+    h2o_nif_server_t *server = thread->server;
     h2o_nif_config_t *config = &server->config;
     h2o_nif_srv_listen_t *listeners = enif_alloc(sizeof(*listeners) * config->num_listeners);
     (void)memset(listeners, 0, sizeof(*listeners) * config->num_listeners);
     size_t i;
 
     thread->ctx.thread = thread;
+    thread->listeners = listeners;
+    thread->shutting_down = 0;
+    (void)h2o_nif_hist_init(&thread->accept_usec);
 
-    h2o_loop_t *loop = h2o_evloop_create();
-    thread->ipc_queue = h2o_nif_ipc_create_queue(loop);
-    assert(thread->ipc_queue != NULL);
-    (void)h2o_context_init(&thread->ctx.super, loop, &config->globalconf);
+    (void)h2o_context_init(&thread->ctx.super, loop->loop, &config->globalconf);
     (void)h2o_multithread_register_receiver(thread->ctx.super.queue, &thread->server_notifications, on_server_notification);
     (void)h2o_multithread_register_receiver(thread->ctx.super.queue, &thread->memcached, h2o_memcached_receiver);
     // (void)h2o_multithread_register_receiver(thread->ctx.super.queue, &thread->erlang, on_erlang);
@@ -216,8 +1063,11 @@ h2o_nif_server_run_loop(void *arg)
     for (i = 0; i != config->num_listeners; ++i) {
         h2o_nif_cfg_listen_t *listener_config = config->listeners[i];
         int fd;
-        /* dup the listener fd for other threads than the main thread */
-        if (thread->idx == 0) {
+        /* each thread owns a SO_REUSEPORT socket if available, otherwise dup the listener fd for other threads than the main
+         * thread */
+        if (listener_config->fds != NULL) {
+            fd = listener_config->fds[thread->idx];
+        } else if (thread->idx == 0) {
             fd = listener_config->fd;
         } else {
             if ((fd = dup(listener_config->fd)) == -1) {
@@ -226,47 +1076,46 @@ h2o_nif_server_run_loop(void *arg)
             }
             (void)set_cloexec(fd);
         }
+        /* a dup'ed fd shares the socket of the main thread, which already set the option */
+        if (loop->pool->config.busy_poll_usec != 0 && (listener_config->fds != NULL || thread->idx == 0)) {
+            (void)set_busy_poll(fd, loop->pool->config.busy_poll_usec);
+        }
         (void)memset(listeners + i, 0, sizeof(listeners[i]));
         listeners[i].thread = thread;
         listeners[i].accept_ctx.ctx = &thread->ctx.super;
         listeners[i].accept_ctx.hosts = listener_config->hosts;
-        // if (listener_config->ssl.size != 0)
-        //  listeners[i].accept_ctx.ssl_ctx = listener_config->ssl.entries[0]->ctx;
+        if (listener_config->ssl.size != 0)
+            listeners[i].accept_ctx.ssl_ctx = listener_config->ssl.entries[0]->ctx;
         listeners[i].accept_ctx.expect_proxy_line = listener_config->proxy_protocol;
         listeners[i].accept_ctx.libmemcached_receiver = &thread->memcached;
-        listeners[i].sock = h2o_evloop_socket_create(thread->ctx.super.loop, fd, H2O_SOCKET_FLAG_DONT_READ);
+        listeners[i].sock = h2o_evloop_socket_create(loop->loop, fd, H2O_SOCKET_FLAG_DONT_READ);
         listeners[i].sock->data = listeners + i;
     }
     /* and start listening */
     (void)update_listener_state(listeners);
 
-    (void)atomic_fetch_add_explicit(&server->initialized_threads, 1, memory_order_relaxed);
-    /* the main loop */
-    while (1) {
-        if (atomic_load_explicit(&server->shutdown_requested, memory_order_relaxed)) {
-            break;
-        }
-        (void)update_listener_state(listeners);
-        /* run the loop once */
-        (void)h2o_evloop_run(thread->ctx.super.loop, INT32_MAX);
-        (void)h2o_filecache_clear(thread->ctx.super.filecache);
-    }
+    (void)h2o_linklist_insert(&loop->threads, &thread->_link);
+    (void)atomic_fetch_add_explicit(&server->initialized_threads, 1, memory_order_release);
+}
 
-    /* shutdown requested, unregister, close the listeners and notify the protocol handlers */
-    for (i = 0; i != config->num_listeners; ++i) {
-        (void)h2o_socket_read_stop(listeners[i].sock);
-    }
-    (void)h2o_evloop_run(thread->ctx.super.loop, 0);
-    for (i = 0; i != config->num_listeners; ++i) {
-        (void)h2o_socket_close(listeners[i].sock);
-        listeners[i].sock = NULL;
+static int
+thread_can_accept(h2o_nif_srv_thread_t *thread, int refresh)
+{
+    h2o_nif_server_t *server = thread->server;
+    int max_connections = server->config.max_connections;
+    if (refresh || thread->conns.since_refresh >= H2O_NIF_SRV_CONNS_REFRESH ||
+        thread->conns.approx_total + thread->conns.since_refresh >= max_connections) {
+        thread->conns.approx_total = num_connections(server);
+        thread->conns.since_refresh = 0;
     }
-    (void)h2o_context_request_shutdown(&thread->ctx.super);
+    return (thread->conns.approx_total + thread->conns.since_refresh < max_connections);
+}
 
-    /* wait until all the connection gets closed */
-    while (num_connections(server, 0) != 0) {
-        (void)h2o_evloop_run(thread->ctx.super.loop, INT32_MAX);
-    }
+static void
+thread_detach(h2o_nif_srv_thread_t *thread)
+{
+    h2o_nif_srv_loop_t *loop = thread->loop;
+    h2o_nif_server_t *server = thread->server;
 
     /* dispose of the context */
     // (void)h2o_multithread_unregister_receiver(thread->ctx.super.queue, &thread->erlang);
@@ -275,114 +1124,133 @@ h2o_nif_server_run_loop(void *arg)
     (void)context_clear_timeouts(&thread->ctx.super);
     (void)h2o_context_dispose(&thread->ctx.super);
 
-    (void)h2o_nif_ipc_destroy_queue(thread->ipc_queue);
-    thread->ipc_queue = NULL;
-
-    /* destroy the loop */
-    (void)h2o_evloop_destroy(thread->ctx.super.loop);
-
     /* free the listeners */
-    (void)enif_free(listeners);
+    (void)enif_free(thread->listeners);
+    thread->listeners = NULL;
 
-    (void)atomic_fetch_add_explicit(&server->shutdown_threads, 1, memory_order_relaxed);
+    (void)h2o_linklist_unlink(&thread->_link);
+    if (loop->pool->name == NULL && h2o_linklist_is_empty(&loop->threads)) {
+        loop->exit = 1;
+    }
 
-    return NULL;
+    /* retired threads detach while the server runs, the last one to go after a close takes the server down */
+    size_t num_detached = atomic_fetch_add_explicit(&server->shutdown_threads, 1, memory_order_acq_rel) + 1;
+    if (atomic_load_explicit(&server->shutdown_requested, memory_order_acquire) &&
+        num_detached == atomic_load_explicit(&server->started_threads, memory_order_relaxed)) {
+        (void)server_dispose(server);
+    }
 }
 
-static void
-context_clear_timeout(h2o_loop_t *loop, h2o_timeout_t *timeout)
+static h2o_nif_srv_thread_t *
+thread_init(h2o_nif_server_t *server, size_t idx, h2o_nif_srv_loop_t *loop)
 {
-    while (!h2o_linklist_is_empty(&timeout->_entries)) {
-        // TRACE_F("there's a timeout entry\n");
-        h2o_timeout_entry_t *entry = H2O_STRUCT_FROM_MEMBER(h2o_timeout_entry_t, _link, timeout->_entries.next);
-        (void)h2o_linklist_unlink(&entry->_link);
-        entry->registered_at = 0;
-        entry->cb(entry);
-        (void)h2o_timeout__do_post_callback(loop);
+    /* a slot left by a retired thread is reused, `num_connections` may be reading its (zero) counters meanwhile */
+    h2o_nif_srv_thread_t *thread = server->threads[idx];
+    if (thread == NULL) {
+        thread = enif_alloc(sizeof(*thread));
+        (void)memset(thread, 0, sizeof(*thread));
+        (void)atomic_init(&thread->conns.num_connections, 0);
+        (void)atomic_init(&thread->conns.num_sessions, 0);
+        (void)atomic_init(&thread->conns.accept_paused, 0);
+        (void)atomic_init(&thread->retire, 0);
+        server->threads[idx] = thread;
     }
-    return;
+    thread->server = server;
+    thread->idx = idx;
+    thread->loop = loop;
+    thread->listeners = NULL;
+    thread->shutting_down = 0;
+    thread->retiring = 0;
+    thread->conns.approx_total = 0;
+    thread->conns.since_refresh = 0;
+    (void)atomic_store_explicit(&thread->retire, 0, memory_order_relaxed);
+    return thread;
 }
 
 static void
-context_clear_timeouts(h2o_context_t *ctx)
+thread_num_connections(h2o_nif_srv_thread_t *thread, int delta)
 {
-    // TRACE_F("clear zero_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->zero_timeout);
-    // TRACE_F("clear one_sec_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->one_sec_timeout);
-    // TRACE_F("clear hundred_ms_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->hundred_ms_timeout);
-    // TRACE_F("clear handshake_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->handshake_timeout);
-    // TRACE_F("clear http1.req_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->http1.req_timeout);
-    // TRACE_F("clear http2.idle_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->http2.idle_timeout);
-    // TRACE_F("clear http2.graceful_shutdown_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->http2.graceful_shutdown_timeout);
-    // TRACE_F("clear proxy.io_timeout\n");
-    (void)context_clear_timeout(ctx->loop, &ctx->proxy.io_timeout);
-    return;
+    /* only the owning loop thread writes these, so plain load/store is enough */
+    (void)atomic_store_explicit(&thread->conns.num_connections,
+                                atomic_load_explicit(&thread->conns.num_connections, memory_order_relaxed) + delta,
+                                memory_order_relaxed);
+    if (delta > 0) {
+        (void)atomic_store_explicit(&thread->conns.num_sessions,
+                                    atomic_load_explicit(&thread->conns.num_sessions, memory_order_relaxed) + delta,
+                                    memory_order_relaxed);
+    }
+    thread->conns.since_refresh += delta;
 }
 
 static void
-notify_all_threads(h2o_nif_server_t *server)
+thread_shutdown(h2o_nif_srv_thread_t *thread)
 {
-    unsigned i;
-    for (i = 0; i != server->config.num_threads; ++i) {
-        (void)h2o_multithread_send_message(&server->threads[i].server_notifications, NULL);
+    /* shutdown requested, unregister, close the listeners and notify the protocol handlers */
+    h2o_nif_server_t *server = thread->server;
+    h2o_nif_config_t *config = &server->config;
+    size_t i;
+    for (i = 0; i != config->num_listeners; ++i) {
+        h2o_nif_cfg_listen_t *listener_config = config->listeners[i];
+        if (thread->retiring && listener_config->fds != NULL) {
+            /* connections queued on a reuseport socket are reset when it closes, take them all whatever `max-connections` says */
+            h2o_socket_t *sock;
+            while ((sock = h2o_evloop_socket_accept(thread->listeners[i].sock)) != NULL) {
+                (void)thread_accept(&thread->listeners[i], sock);
+            }
+            listener_config->fds[thread->idx] = -1;
+        }
+        (void)h2o_socket_read_stop(thread->listeners[i].sock);
+        (void)h2o_socket_close(thread->listeners[i].sock);
+        thread->listeners[i].sock = NULL;
     }
-}
-
-static int
-num_connections(h2o_nif_server_t *server, int delta)
-{
-    return atomic_fetch_add_explicit(&server->state._num_connections, delta, memory_order_relaxed);
-}
-
-static unsigned long
-num_sessions(h2o_nif_server_t *server, int delta)
-{
-    return atomic_fetch_add_explicit(&server->state._num_sessions, delta, memory_order_relaxed);
+    /* a thread going away no longer counts as paused, so closes wake the remaining ones */
+    if (atomic_load_explicit(&thread->conns.accept_paused, memory_order_relaxed) &&
+        atomic_exchange_explicit(&thread->conns.accept_paused, 0, memory_order_relaxed)) {
+        (void)atomic_fetch_sub_explicit(&server->state.listeners_paused, 1, memory_order_relaxed);
+    }
+    /* for a retired thread too: HTTP/2 clients get a GOAWAY and reconnect to the remaining threads */
+    (void)h2o_context_request_shutdown(&thread->ctx.super);
+    thread->shutting_down = 1;
 }
 
 static void
 on_accept(h2o_socket_t *listener, const char *err)
 {
     h2o_nif_srv_listen_t *ctx = listener->data;
-    h2o_nif_server_t *server = ctx->thread->server;
-    h2o_nif_config_t *config = &server->config;
-    size_t num_accepts = config->max_connections / 16 / config->num_threads;
-    if (num_accepts < 8) {
-        num_accepts = 8;
-    }
 
     if (err != NULL) {
         return;
     }
 
+    uint64_t started = h2o_nif_hist_now_usec();
+    size_t num_accepts = thread_accept_batch(ctx->thread);
+    if (ctx->thread->loop->stats.woke_usec == 0) {
+        ctx->thread->loop->stats.woke_usec = started;
+    }
+
     do {
         h2o_socket_t *sock;
-        if (num_connections(server, 0) >= config->max_connections) {
+        if (!thread_can_accept(ctx->thread, 0)) {
             /* The accepting socket is disactivated before entering the next in `run_loop`.
-             * Note: it is possible that the server would accept at most `max_connections + num_threads` connections, since the
-             * server does not check if the number of connections has exceeded _after_ epoll notifies of a new connection _but_
-             * _before_ calling `accept`.  In other words t/40max-connections.t may fail.
+             * Note: the check works on a lazily refreshed total, so the server may accept at most
+             * `max_connections + num_threads * (H2O_NIF_SRV_CONNS_REFRESH + 1)` connections (see server.h).
              */
             break;
         }
         if ((sock = h2o_evloop_socket_accept(listener)) == NULL) {
             break;
         }
-        (void)num_connections(server, 1);
-        (void)num_sessions(server, 1);
+        (void)thread_accept(ctx, sock);
 
-        sock->on_close.cb = on_socketclose;
-        sock->on_close.data = ctx;
+    } while (--num_accepts != 0);
 
-        (void)h2o_accept(&ctx->accept_ctx, sock);
+    (void)h2o_nif_hist_record(&ctx->thread->accept_usec, h2o_nif_hist_now_usec() - started);
+}
 
-    } while (--num_accepts != 0);
+static void
+on_attach(h2o_nif_ipc_message_t *message)
+{
+    (void)loop_attach_pending(((h2o_nif_srv_attach_t *)message)->loop);
 }
 
 // static void
@@ -415,14 +1283,83 @@ on_socketclose(void *data)
 {
     h2o_nif_srv_listen_t *ctx = data;
     h2o_nif_server_t *server = ctx->thread->server;
-    h2o_nif_config_t *config = &server->config;
 
-    int prev_num_connections = num_connections(server, -1);
+    (void)thread_num_connections(ctx->thread, -1);
 
-    if (prev_num_connections == config->max_connections) {
-        /* ready to accept new connections. wake up all the threads! */
-        (void)notify_all_threads(server);
+    /* the count is only written when threads pause or resume, so polling it here keeps the line shared in all caches */
+    if (atomic_load_explicit(&server->state.listeners_paused, memory_order_relaxed) > 0) {
+        /* ready to accept new connections. wake up the least loaded threads */
+        (void)notify_least_loaded_threads(ctx->thread);
+    }
+}
+
+static void
+record_loop_pass(h2o_nif_srv_loop_t *loop, uint64_t woke_usec)
+{
+    /*
+     * `woke_usec` is 0 when the pass was woken up by connection I/O or a timer, which run no callback of ours: only the
+     * millisecond loop clock tells when poll returned then.  That is good enough for the watchdog, but such passes are left out
+     * of `pass_usec`, a sub-millisecond histogram would be mostly rounding.
+     */
+    h2o_nif_watchdog_t *watchdog = &loop->stats.watchdog;
+    h2o_nif_ipc_stats_t *ipc_stats = &loop->ipc_stats;
+    uint64_t pass_usec;
+    if (woke_usec != 0) {
+        uint64_t now = h2o_nif_hist_now_usec();
+        pass_usec = (now > woke_usec) ? now - woke_usec : 0;
+        (void)h2o_nif_hist_record(&loop->stats.pass_usec, pass_usec);
+    } else {
+        /* the loop clock is wall-clock time, unlike `h2o_nif_hist_now_usec` */
+        struct timeval tv;
+        (void)gettimeofday(&tv, NULL);
+        uint64_t now = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+        uint64_t polled_at = h2o_now(loop->loop) * 1000;
+        pass_usec = (now > polled_at) ? now - polled_at : 0;
+    }
+    if (watchdog->threshold_usec != 0 && pass_usec >= watchdog->threshold_usec) {
+        (void)h2o_nif_watchdog_record(watchdog, pass_usec, (uintptr_t)ipc_stats->slowest.cb, ipc_stats->slowest.usec);
+    }
+    ipc_stats->slowest.cb = NULL;
+    ipc_stats->slowest.usec = 0;
+}
+
+static void
+server_dispose(h2o_nif_server_t *server)
+{
+    /*
+     * Run by the loop thread detaching the last thread of a closed server: no context, listener or connection uses the config
+     * anymore, while the loops of a shared pool keep running for the other servers.
+     */
+    size_t num_slots = atomic_load_explicit(&server->num_slots, memory_order_relaxed);
+    h2o_nif_srv_thread_t **threads;
+    size_t i;
+    /* `stop_loops` and `h2o_nif_server_set_threads` read the threads under the mutex */
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    threads = server->threads;
+    server->threads = NULL;
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    for (i = 0; i != num_slots; ++i) {
+        (void)enif_free(threads[i]);
+    }
+    (void)enif_free(threads);
+    (void)h2o_nif_config_dispose(&server->config);
+    /* taken by `h2o_nif_server_open` */
+    (void)h2o_nif_port_release(&server->super);
+}
+
+static void
+set_busy_poll(int fd, uint64_t usec)
+{
+#ifdef SO_BUSY_POLL
+    /* raising the value above `net.core.busy_read` needs CAP_NET_ADMIN; the loop still spins without it */
+    int value = (int)usec;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value, sizeof(value)) != 0) {
+        fprintf(stderr, "[warning] failed to set SO_BUSY_POLL:%s\n", strerror(errno));
     }
+#else
+    (void)fd;
+    (void)usec;
+#endif
 }
 
 static void
@@ -434,27 +1371,104 @@ set_cloexec(int fd)
     }
 }
 
+static void
+set_thread_placement(h2o_nif_srv_loop_t *loop)
+{
+#ifdef __linux__
+    h2o_nif_srv_pool_t *pool = loop->pool;
+    h2o_nif_cfg_cpus_t *cpus = NULL;
+    if (pool->config.num_cpu_affinity != 0) {
+        cpus = &pool->config.cpu_affinity[loop->idx % pool->config.num_cpu_affinity];
+    }
+    if (cpus != NULL && cpus->size != 0) {
+        cpu_set_t set;
+        size_t i;
+        CPU_ZERO(&set);
+        for (i = 0; i != cpus->size; ++i) {
+            CPU_SET(cpus->entries[i], &set);
+        }
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0) {
+            (void)fprintf(stderr, "[warning] failed to set cpu affinity of thread %zu:%s\n", loop->idx, strerror(error));
+        }
+    }
+    if (pool->config.numa_local) {
+#ifdef SYS_set_mempolicy
+/* from <numaif.h>, which is only shipped with libnuma */
+#ifndef MPOL_LOCAL
+#define MPOL_LOCAL 4
+#endif
+        /* override any policy inherited from the emulator (e.g. `numactl --interleave`) and allocate on the current node */
+        if (syscall(SYS_set_mempolicy, MPOL_LOCAL, NULL, 0) != 0) {
+            perror("[warning] failed to set local NUMA memory policy");
+        }
+#endif
+    }
+#else
+    (void)loop;
+#endif
+}
+
+static void
+stop_loops(h2o_nif_server_t *server)
+{
+    /*
+     * Every thread of the server closes its listeners, waits for the server's connections to go away and detaches; the loops of
+     * a shared pool keep running for the other servers.  A private pool's loops exit with their thread and are joined later on
+     * (see `pools_reap`), never here: this runs on a scheduler or in a monitor callback.
+     */
+    size_t num_threads;
+    size_t i;
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    h2o_nif_srv_pool_t *pool = server->threads[0]->loop->pool;
+    (void)atomic_store_explicit(&server->shutdown_requested, 1, memory_order_release);
+    num_threads = atomic_load_explicit(&server->num_threads, memory_order_relaxed);
+    for (i = 0; i != num_threads; ++i) {
+        (void)h2o_multithread_send_message(&server->threads[i]->server_notifications, NULL);
+    }
+    if (pool->name == NULL) {
+        pool->next = stopped_pools;
+        stopped_pools = pool;
+    }
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    (void)pools_reap();
+}
+
 static void
 update_listener_state(h2o_nif_srv_listen_t *listeners)
 {
     if (listeners == NULL) {
         return;
     }
-    h2o_nif_server_t *server = listeners[0].thread->server;
+    h2o_nif_srv_thread_t *thread = listeners[0].thread;
+    h2o_nif_server_t *server = thread->server;
     h2o_nif_config_t *config = &server->config;
     size_t i;
+    /* re-sum only while paused, a running thread keeps using its lazily refreshed total */
+    int paused = (config->num_listeners != 0 && !h2o_socket_is_reading(listeners[0].sock));
 
-    if (num_connections(server, 0) < config->max_connections) {
+    if (thread_can_accept(thread, paused)) {
         for (i = 0; i != config->num_listeners; ++i) {
             if (!h2o_socket_is_reading(listeners[i].sock)) {
                 (void)h2o_socket_read_start(listeners[i].sock, on_accept);
             }
         }
+        /* resumed on our own rather than by a wakeup */
+        if (atomic_load_explicit(&thread->conns.accept_paused, memory_order_relaxed) &&
+            atomic_exchange_explicit(&thread->conns.accept_paused, 0, memory_order_relaxed)) {
+            (void)atomic_fetch_sub_explicit(&server->state.listeners_paused, 1, memory_order_relaxed);
+        }
     } else {
         for (i = 0; i != config->num_listeners; ++i) {
             if (h2o_socket_is_reading(listeners[i].sock)) {
                 (void)h2o_socket_read_stop(listeners[i].sock);
             }
         }
+        /* a close racing with this store goes unnoticed until the loop wakes up again, which a thread at the limit does soon
+         * since it is serving connections */
+        if (!atomic_load_explicit(&thread->conns.accept_paused, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&thread->conns.accept_paused, 1, memory_order_relaxed)) {
+            (void)atomic_fetch_add_explicit(&server->state.listeners_paused, 1, memory_order_relaxed);
+        }
     }
 }
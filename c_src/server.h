@@ -7,12 +7,28 @@
 #include "globals.h"
 #include "port.h"
 #include "config.h"
+#include "hist.h"
+#include "env.h"
 #include "ipc.h"
 
+/*
+ * A thread re-sums the connection counts of all threads after this many accepts.  Each thread may therefore accept up to this many
+ * connections on top of a stale total, so `max-connections` may be exceeded by at most
+ * `num-threads * (H2O_NIF_SRV_CONNS_REFRESH + 1)` connections (the `+ 1` covers the race between epoll and `accept`).
+ */
+#define H2O_NIF_SRV_CONNS_REFRESH 16
+
+/* Bounds for the adaptive number of connections accepted per listener wakeup (see `thread_accept_batch` in server.c). */
+#define H2O_NIF_SRV_ACCEPT_MIN 8
+#define H2O_NIF_SRV_ACCEPT_LAG_MS 5
+
 /* Types */
 
 typedef struct h2o_nif_server_s h2o_nif_server_t;
 typedef struct h2o_nif_srv_listen_s h2o_nif_srv_listen_t;
+typedef struct h2o_nif_srv_loop_s h2o_nif_srv_loop_t;
+typedef struct h2o_nif_srv_pool_s h2o_nif_srv_pool_t;
+typedef struct h2o_nif_srv_ready_s h2o_nif_srv_ready_t;
 typedef struct h2o_nif_srv_thread_s h2o_nif_srv_thread_t;
 typedef struct h2o_nif_srv_thread_ctx_s h2o_nif_srv_thread_ctx_t;
 
@@ -22,40 +38,131 @@ struct h2o_nif_srv_listen_s {
     h2o_socket_t *sock;
 };
 
+struct h2o_nif_srv_ready_s {
+    h2o_nif_port_t *port; /* kept until the notification is flushed */
+    atomic_flag *state;   /* cleared again if the owner could not be notified */
+    ErlNifPid owner;      /* looked up when flushing, entries are sorted by it */
+};
+
+/*
+ * An event loop thread.  It runs the contexts of all the server threads attached to it, at most one per server: a server gets a
+ * private pool of loops unless it names a shared `loop-pool`.
+ */
+struct h2o_nif_srv_loop_s {
+    h2o_nif_srv_pool_t *pool;
+    size_t idx;
+    ErlNifTid tid;
+    h2o_loop_t *loop;
+    h2o_nif_ipc_queue_t *ipc_queue;
+    h2o_nif_ipc_stats_t ipc_stats;
+    h2o_nif_ssl_stats_t ssl_stats;
+    h2o_nif_env_pool_t envs; /* environments for the messages sent by the loop thread */
+    h2o_linklist_t threads;  /* attached server threads, loop thread only */
+    int exit;                /* set by the loop thread once a private pool has no thread left */
+    _Atomic int exited;      /* set right before the loop thread returns, joining it won't block from then on */
+    /* server threads handed over by `h2o_nif_server_start`, attached by the loop thread */
+    struct {
+        ck_spinlock_t lock;
+        h2o_linklist_t threads;
+        h2o_nif_ipc_queue_t *queue; /* NULL until the loop thread polls, pending threads are then attached on startup */
+    } attach;
+    /* event loop timings, written by the loop thread only */
+    struct {
+        h2o_nif_hist_t pass_usec; /* from a wakeup callback or a zero-timeout poll until polling again */
+        h2o_nif_watchdog_t watchdog;
+        uint64_t woke_usec; /* when `on_accept` first ran in the current pass, 0 if it did not */
+    } stats;
+    /* spin-then-block state when `busy-poll-usec` is set, loop thread only */
+    struct {
+        uint64_t budget_usec;      /* spin length for the next pass, halved after every spin that found no IPC message */
+        uint64_t messages_drained; /* `ipc_stats.messages_drained` when the last spin ended */
+    } busy_poll;
+    /*
+     * Ports that became ready for input during the current pass, loop thread only.  They are flushed once the pass is over with
+     * a single message per owner (see `flush_ready_input` in server.c).
+     */
+    struct {
+        ErlNifEnv *env;
+        H2O_VECTOR(h2o_nif_srv_ready_t) ports;
+    } ready;
+};
+
+/*
+ * A set of loops.  The loop settings are copied from the config of the server creating the pool, servers attaching later only
+ * bring their listeners, hosts and connection limits.  Named pools live until the NIF is unloaded, a private pool is joined once
+ * its server is closed and its loop threads returned.
+ */
+struct h2o_nif_srv_pool_s {
+    h2o_nif_srv_pool_t *next; /* registry of named pools or of stopped private pools, guarded by `h2o_nif_mutex` */
+    char *name;               /* NULL for the private pool of a single server */
+    size_t num_loops;
+    size_t num_slots;           /* loops ever started, `server_set_threads/2` reuses the slots of retired ones */
+    h2o_nif_srv_loop_t **loops; /* room for H2O_NIF_CONFIG_MAX_THREADS */
+    /* loops replaced in their slot by `server_set_threads/2`, joined once their thread exited; guarded by `h2o_nif_mutex` */
+    H2O_VECTOR(h2o_nif_srv_loop_t *) retired;
+    struct {
+        h2o_nif_cfg_cpus_t *cpu_affinity; /* CPU sets assigned to the loops round-robin, NULL when unpinned */
+        size_t num_cpu_affinity;
+        int numa_local;
+        size_t ipc_budget_messages;
+        uint64_t ipc_budget_usec;
+        uint64_t loop_watchdog_usec;
+        uint64_t busy_poll_usec;
+    } config;
+};
+
 struct h2o_nif_srv_thread_ctx_s {
     h2o_context_t super;
     h2o_nif_srv_thread_t *thread;
 };
 
+/* The share of a server run by one loop. */
 struct h2o_nif_srv_thread_s {
     h2o_nif_server_t *server;
     size_t idx;
-    ErlNifTid tid;
+    h2o_nif_srv_loop_t *loop;
+    h2o_linklist_t _link; /* in `loop->attach.threads` until attached, then in `loop->threads` */
     h2o_nif_srv_thread_ctx_t ctx;
     h2o_multithread_receiver_t server_notifications;
     h2o_multithread_receiver_t memcached;
     // h2o_multithread_receiver_t erlang;
-    h2o_nif_ipc_queue_t *ipc_queue;
+    h2o_nif_srv_listen_t *listeners;
+    int shutting_down;          /* listeners closed, waiting for the connections to go away, loop thread only */
+    int retiring;               /* shutting down for `server_set_threads/2` rather than for the server, loop thread only */
+    _Atomic int retire;         /* set by `h2o_nif_server_set_threads` to take the thread down on the next pass */
+    h2o_nif_hist_t accept_usec; /* time spent in `on_accept`, written by the loop thread only */
+    /*
+     * Connection accounting is sharded per thread: only the owning loop thread writes its counters and the global
+     * `max-connections` check works on a total that is re-summed lazily (see `H2O_NIF_SRV_CONNS_REFRESH`).
+     */
+    struct {
+        /* unused buffers exist to avoid false sharing of the cache line (and the adjacent line fetched by the prefetcher) */
+        char _unused1_avoir_false_sharing[128];
+        _Atomic int num_connections;        /* number of currently handled incoming connections */
+        _Atomic unsigned long num_sessions; /* total number of opened incoming connections */
+        int approx_total;                   /* sum over all threads at the last refresh, loop thread only */
+        int since_refresh;                  /* change of this thread's count since `approx_total` was summed, loop thread only */
+        _Atomic int accept_paused;          /* listeners stopped at the limit; cleared by whoever wakes the thread */
+        char _unused2_avoir_false_sharing[128];
+    } conns;
 };
 
 struct h2o_nif_server_s {
     h2o_nif_port_t super;
     h2o_nif_config_t config;
     time_t launch_time;
-    h2o_nif_srv_thread_t *threads;
+    h2o_nif_srv_thread_t **threads; /* room for H2O_NIF_CONFIG_MAX_THREADS, a slot is filled before the counts cover it */
+    _Atomic size_t num_threads;     /* threads accepting connections, the first ones of `threads` */
+    _Atomic size_t num_slots;       /* threads ever started, the retired ones above `num_threads` may still drain */
     _Atomic int shutdown_requested;
+    _Atomic size_t started_threads; /* threads ever handed over to a loop, attached or not yet */
     _Atomic size_t initialized_threads;
     _Atomic size_t shutdown_threads;
     struct {
         /* unused buffers exist to avoid false sharing of the cache line */
-        char _unused1_avoir_false_sharing[32];
-        _Atomic int
-            _num_connections; /* number of currently handled incoming connections, should use atomic functions to update the value
-                                 */
-        char _unused2_avoir_false_sharing[32];
-        _Atomic unsigned long
-            _num_sessions; /* total number of opened incoming connections, should use atomic functions to update the value */
-        char _unused3_avoir_false_sharing[32];
+        char _unused1_avoir_false_sharing[128];
+        _Atomic int listeners_paused; /* number of threads that stopped accepting because `max-connections` was reached */
+        char _unused2_avoir_false_sharing[128];
     } state;
 };
 
@@ -83,5 +190,8 @@ extern int h2o_nif_server_open(h2o_nif_server_t **serverp);
 /* Server Functions */
 
 extern int h2o_nif_server_start(h2o_nif_server_t *server);
+extern int h2o_nif_server_set_threads(h2o_nif_server_t *server, size_t num_threads, ERL_NIF_TERM *reason);
+extern int h2o_nif_server_get_stats(h2o_nif_server_t *server, ErlNifEnv *env, ERL_NIF_TERM *out);
+extern void h2o_nif_server_ready_input(h2o_context_t *ctx, h2o_nif_port_t *port, atomic_flag *state);
 
 #endif
@@ -0,0 +1,577 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/pem.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+
+#include "ssl.h"
+#include <h2o/http2.h>
+
+#define H2O_NIF_SSL_STORE_MIN_BUCKETS 64
+
+static int ssl_ex_index = -1;
+/* set on a connection whose client presented a ticket we could decrypt */
+static int ssl_ticket_ex_index = -1;
+/* set by each loop thread, handshakes only ever run on loop threads */
+static _Thread_local h2o_nif_ssl_stats_t *ssl_thread_stats = NULL;
+
+static void on_info(const SSL *ssl, int where, int ret);
+static int on_ticket_key(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc);
+static uint64_t hash_name(const char *name, size_t len);
+static h2o_nif_ssl_cert_t **find_cert(h2o_nif_ssl_store_t *store, const char *name, size_t len);
+static void free_cert(h2o_nif_ssl_cert_t *cert);
+static int grow_buckets(h2o_nif_ssl_store_t *store);
+static SSL_CTX *create_store_ctx(h2o_nif_ssl_store_t *store, int is_pem, h2o_iovec_t certificate, h2o_iovec_t key);
+
+/* Resumption Functions */
+
+int
+h2o_nif_ssl_resumption_init(h2o_nif_ssl_resumption_t *resumption)
+{
+    (void)memset(resumption, 0, sizeof(*resumption));
+    resumption->mode = H2O_NIF_SSL_RESUMPTION_ALL;
+    resumption->cache_capacity = 4096;
+    resumption->cache_lifetime = 3600;
+    resumption->ticket_lifetime = 3600;
+    resumption->tickets.lock = enif_rwlock_create("h2o_nif_ssl_tickets");
+    if (resumption->tickets.lock == NULL) {
+        return 0;
+    }
+    return 1;
+}
+
+void
+h2o_nif_ssl_resumption_dispose(h2o_nif_ssl_resumption_t *resumption)
+{
+    if (resumption->tickets.lock != NULL) {
+        (void)enif_rwlock_destroy(resumption->tickets.lock);
+    }
+    /* don't leave key material behind */
+    (void)OPENSSL_cleanse(resumption->tickets.entries, sizeof(resumption->tickets.entries));
+    (void)memset(resumption, 0, sizeof(*resumption));
+    return;
+}
+
+int
+h2o_nif_ssl_setup_session_resumption(h2o_nif_ssl_resumption_t *resumption, SSL_CTX **contexts, size_t num_contexts)
+{
+    size_t i;
+
+    (void)enif_mutex_lock(h2o_nif_mutex);
+    if (ssl_ex_index == -1) {
+        ssl_ex_index = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+    if (ssl_ticket_ex_index == -1) {
+        ssl_ticket_ex_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+    (void)enif_mutex_unlock(h2o_nif_mutex);
+    if (ssl_ex_index == -1 || ssl_ticket_ex_index == -1) {
+        return 0;
+    }
+
+    for (i = 0; i != num_contexts; ++i) {
+        SSL_CTX *ctx = contexts[i];
+        (void)SSL_CTX_set_ex_data(ctx, ssl_ex_index, resumption);
+        (void)SSL_CTX_set_info_callback(ctx, on_info);
+        /* the session cache of a SSL_CTX is shared by all the loop threads of the process */
+        if ((resumption->mode & H2O_NIF_SSL_RESUMPTION_CACHE) != 0) {
+            (void)SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+            (void)SSL_CTX_sess_set_cache_size(ctx, (long)resumption->cache_capacity);
+            (void)SSL_CTX_set_timeout(ctx, (long)resumption->cache_lifetime);
+        } else {
+            (void)SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        }
+        if ((resumption->mode & H2O_NIF_SSL_RESUMPTION_TICKET) != 0) {
+            (void)SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+            (void)SSL_CTX_set_tlsext_ticket_key_cb(ctx, on_ticket_key);
+        } else {
+            (void)SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        }
+    }
+
+    return 1;
+}
+
+/* Store Functions */
+
+int
+h2o_nif_ssl_store_init(h2o_nif_ssl_store_t *store, h2o_nif_ssl_resumption_t *resumption)
+{
+    (void)memset(store, 0, sizeof(*store));
+    store->resumption = resumption;
+    store->capacity = 1024;
+    (void)atomic_init(&store->num_certs, 0);
+    (void)h2o_linklist_init_anchor(&store->lru);
+    store->num_buckets = H2O_NIF_SSL_STORE_MIN_BUCKETS;
+    store->buckets = enif_alloc(sizeof(store->buckets[0]) * store->num_buckets);
+    if (store->buckets == NULL) {
+        return 0;
+    }
+    (void)memset(store->buckets, 0, sizeof(store->buckets[0]) * store->num_buckets);
+    store->lock = enif_mutex_create("h2o_nif_ssl_store");
+    if (store->lock == NULL) {
+        (void)enif_free(store->buckets);
+        store->buckets = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+void
+h2o_nif_ssl_store_dispose(h2o_nif_ssl_store_t *store)
+{
+    size_t i;
+    if (store->buckets != NULL) {
+        for (i = 0; i != store->num_buckets; ++i) {
+            h2o_nif_ssl_cert_t *cert = store->buckets[i];
+            while (cert != NULL) {
+                h2o_nif_ssl_cert_t *next = cert->next;
+                (void)free_cert(cert);
+                cert = next;
+            }
+        }
+        (void)enif_free(store->buckets);
+    }
+    if (store->lock != NULL) {
+        (void)enif_mutex_destroy(store->lock);
+    }
+    (void)memset(store, 0, sizeof(*store));
+    return;
+}
+
+int
+h2o_nif_ssl_store_put(h2o_nif_ssl_store_t *store, h2o_iovec_t name, int is_pem, h2o_iovec_t certificate, h2o_iovec_t key)
+{
+    h2o_nif_ssl_cert_t *cert = NULL;
+    h2o_nif_ssl_cert_t **slot = NULL;
+    h2o_nif_ssl_cert_t *old = NULL;
+    size_t i;
+
+    if (name.len == 0 || name.len > 255 || certificate.len == 0 || key.len == 0 ||
+        memchr(name.base, '\0', name.len) != NULL) {
+        return 0;
+    }
+    if ((cert = enif_alloc(sizeof(*cert) + name.len + certificate.len + key.len + 2)) == NULL) {
+        return 0;
+    }
+    (void)memset(cert, 0, sizeof(*cert));
+    cert->_lru.prev = cert->_lru.next = NULL;
+    cert->name.base = (char *)(cert + 1);
+    cert->name.len = name.len;
+    for (i = 0; i != name.len; ++i) {
+        cert->name.base[i] = h2o_tolower(name.base[i]);
+    }
+    cert->is_pem = is_pem;
+    /* file names need the NUL terminator, PEM data doesn't mind it */
+    cert->certificate.base = cert->name.base + name.len;
+    cert->certificate.len = certificate.len;
+    (void)memcpy(cert->certificate.base, certificate.base, certificate.len);
+    cert->certificate.base[certificate.len] = '\0';
+    cert->key.base = cert->certificate.base + certificate.len + 1;
+    cert->key.len = key.len;
+    (void)memcpy(cert->key.base, key.base, key.len);
+    cert->key.base[key.len] = '\0';
+
+    (void)enif_mutex_lock(store->lock);
+    cert->version = ++store->next_version;
+    slot = find_cert(store, cert->name.base, cert->name.len);
+    if (*slot != NULL) {
+        /* replace in place, handshakes already using the old SSL_CTX keep their own reference to it */
+        old = *slot;
+        cert->next = old->next;
+        if (old->ctx != NULL) {
+            (void)h2o_linklist_unlink(&old->_lru);
+            store->num_loaded--;
+        }
+        *slot = cert;
+    } else {
+        *slot = cert;
+        (void)atomic_fetch_add_explicit(&store->num_certs, 1, memory_order_relaxed);
+        if (atomic_load_explicit(&store->num_certs, memory_order_relaxed) > store->num_buckets * 2) {
+            (void)grow_buckets(store);
+        }
+    }
+    (void)enif_mutex_unlock(store->lock);
+
+    if (old != NULL) {
+        (void)free_cert(old);
+    }
+    return 1;
+}
+
+int
+h2o_nif_ssl_store_select(h2o_nif_ssl_store_t *store, SSL *ssl, const char *server_name)
+{
+    char name[256];
+    size_t name_len = strlen(server_name);
+    h2o_nif_ssl_cert_t *cert = NULL;
+    h2o_nif_ssl_cert_t **slot = NULL;
+    h2o_iovec_t lookup;
+    size_t i;
+
+    if (atomic_load_explicit(&store->num_certs, memory_order_relaxed) == 0 || name_len == 0 || name_len >= sizeof(name)) {
+        return 0;
+    }
+    for (i = 0; i != name_len; ++i) {
+        name[i] = h2o_tolower(server_name[i]);
+    }
+    name[name_len] = '\0';
+
+    (void)enif_mutex_lock(store->lock);
+    /* exact match first, then the wildcard covering the first label */
+    lookup = h2o_iovec_init(name, name_len);
+    slot = find_cert(store, lookup.base, lookup.len);
+    if (*slot == NULL) {
+        const char *dot = memchr(name, '.', name_len);
+        if (dot != NULL && dot != name) {
+            lookup.base = (char *)dot - 1;
+            lookup.len = name_len - (size_t)(lookup.base - name);
+            lookup.base[0] = '*';
+            slot = find_cert(store, lookup.base, lookup.len);
+        }
+    }
+    if ((cert = *slot) == NULL || cert->load_failed) {
+        (void)enif_mutex_unlock(store->lock);
+        return 0;
+    }
+    if (cert->ctx != NULL) {
+        (void)h2o_linklist_unlink(&cert->_lru);
+        (void)h2o_linklist_insert(&store->lru, &cert->_lru);
+        /* under the lock so that an eviction can't free the SSL_CTX before the handshake holds a reference */
+        (void)SSL_set_SSL_CTX(ssl, cert->ctx);
+        (void)enif_mutex_unlock(store->lock);
+        return 1;
+    }
+
+    /* load outside of the lock, the other loop threads keep handshaking meanwhile */
+    {
+        uint64_t version = cert->version;
+        int is_pem = cert->is_pem;
+        h2o_iovec_t certificate = h2o_strdup(NULL, cert->certificate.base, cert->certificate.len);
+        h2o_iovec_t key = h2o_strdup(NULL, cert->key.base, cert->key.len);
+        SSL_CTX *ctx = NULL;
+        (void)enif_mutex_unlock(store->lock);
+
+        ctx = create_store_ctx(store, is_pem, certificate, key);
+        (void)OPENSSL_cleanse(key.base, key.len);
+        (void)free(key.base);
+        (void)free(certificate.base);
+
+        (void)enif_mutex_lock(store->lock);
+        slot = find_cert(store, lookup.base, lookup.len);
+        if ((cert = *slot) == NULL || cert->version != version) {
+            /* replaced or removed while loading */
+            (void)enif_mutex_unlock(store->lock);
+            if (ctx != NULL) {
+                (void)SSL_CTX_free(ctx);
+            }
+            return 0;
+        }
+        if (ctx == NULL) {
+            cert->load_failed = 1;
+            (void)enif_mutex_unlock(store->lock);
+            /* `cert` may be freed as soon as the lock is released, `lookup` is our own copy of its name */
+            (void)fprintf(stderr, "[warning] failed to load certificate for %.*s\n", (int)lookup.len, lookup.base);
+            return 0;
+        }
+        if (cert->ctx != NULL) {
+            /* another thread won the race */
+            (void)SSL_CTX_free(ctx);
+            (void)h2o_linklist_unlink(&cert->_lru);
+        } else {
+            cert->ctx = ctx;
+            store->num_loaded++;
+        }
+        (void)h2o_linklist_insert(&store->lru, &cert->_lru);
+        (void)SSL_set_SSL_CTX(ssl, cert->ctx);
+        while (store->num_loaded > store->capacity && store->lru.next != &cert->_lru) {
+            h2o_nif_ssl_cert_t *victim = H2O_STRUCT_FROM_MEMBER(h2o_nif_ssl_cert_t, _lru, store->lru.next);
+            (void)h2o_linklist_unlink(&victim->_lru);
+            (void)SSL_CTX_free(victim->ctx);
+            victim->ctx = NULL;
+            store->num_loaded--;
+        }
+        (void)enif_mutex_unlock(store->lock);
+        return 1;
+    }
+}
+
+/* Stats Functions */
+
+void
+h2o_nif_ssl_set_thread_stats(h2o_nif_ssl_stats_t *stats)
+{
+    ssl_thread_stats = stats;
+    return;
+}
+
+/* Internal Functions */
+
+static inline void
+stats_incr(_Atomic uint64_t *counter)
+{
+    /* only the owning loop thread writes these, so plain load/store is enough */
+    (void)atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+static void
+on_info(const SSL *ssl, int where, int ret)
+{
+    h2o_nif_ssl_stats_t *stats = ssl_thread_stats;
+    if ((where & SSL_CB_HANDSHAKE_DONE) == 0 || stats == NULL) {
+        return;
+    }
+    if (SSL_session_reused((SSL *)ssl)) {
+        (void)stats_incr(&stats->resumptions);
+        /* the ticket key callback only saw the ticket, it is accepted once the session is actually reused */
+        if (SSL_get_ex_data(ssl, ssl_ticket_ex_index) != NULL) {
+            (void)stats_incr(&stats->ticket_resumptions);
+        }
+    } else {
+        (void)stats_incr(&stats->full_handshakes);
+    }
+}
+
+static int
+generate_ticket_key(h2o_nif_ssl_ticket_key_t *key, uint64_t now)
+{
+    if (RAND_bytes(key->name, sizeof(key->name)) != 1 || RAND_bytes(key->cipher_key, sizeof(key->cipher_key)) != 1 ||
+        RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1) {
+        return 0;
+    }
+    key->not_before = now;
+    return 1;
+}
+
+static h2o_nif_ssl_ticket_key_t *
+current_ticket_key(h2o_nif_ssl_resumption_t *resumption, uint64_t now, h2o_nif_ssl_ticket_key_t *out)
+{
+    h2o_nif_ssl_ticket_key_t *key = NULL;
+    (void)enif_rwlock_rlock(resumption->tickets.lock);
+    if (resumption->tickets.num_keys != 0) {
+        key = &resumption->tickets.entries[resumption->tickets.current];
+        if (now < key->not_before + resumption->ticket_lifetime) {
+            *out = *key;
+            (void)enif_rwlock_runlock(resumption->tickets.lock);
+            return out;
+        }
+    }
+    (void)enif_rwlock_runlock(resumption->tickets.lock);
+
+    /* rotate lazily: the first handshake after the current key expired generates the next one */
+    (void)enif_rwlock_rwlock(resumption->tickets.lock);
+    key = (resumption->tickets.num_keys != 0) ? &resumption->tickets.entries[resumption->tickets.current] : NULL;
+    if (key == NULL || now >= key->not_before + resumption->ticket_lifetime) {
+        size_t next = (resumption->tickets.num_keys == 0) ? 0 : (resumption->tickets.current + 1) % H2O_NIF_SSL_NUM_TICKET_KEYS;
+        if (!generate_ticket_key(&resumption->tickets.entries[next], now)) {
+            (void)enif_rwlock_rwunlock(resumption->tickets.lock);
+            return NULL;
+        }
+        resumption->tickets.current = next;
+        if (resumption->tickets.num_keys < H2O_NIF_SSL_NUM_TICKET_KEYS) {
+            resumption->tickets.num_keys++;
+        }
+        key = &resumption->tickets.entries[next];
+    }
+    *out = *key;
+    (void)enif_rwlock_rwunlock(resumption->tickets.lock);
+    return out;
+}
+
+static int
+on_ticket_key(SSL *ssl, unsigned char *key_name, unsigned char *iv, EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc)
+{
+    h2o_nif_ssl_resumption_t *resumption = SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ssl_ex_index);
+    h2o_nif_ssl_ticket_key_t key;
+    uint64_t now = (uint64_t)time(NULL);
+    int retval;
+
+    if (resumption == NULL) {
+        return -1;
+    }
+
+    if (enc) {
+        if (current_ticket_key(resumption, now, &key) == NULL || RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+            return -1;
+        }
+        (void)memcpy(key_name, key.name, sizeof(key.name));
+        if (!EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.cipher_key, iv) ||
+            !HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL)) {
+            retval = -1;
+        } else {
+            retval = 1;
+        }
+    } else {
+        size_t i;
+        retval = 0;
+        (void)enif_rwlock_rlock(resumption->tickets.lock);
+        for (i = 0; i != resumption->tickets.num_keys; ++i) {
+            h2o_nif_ssl_ticket_key_t *candidate = &resumption->tickets.entries[i];
+            if (memcmp(candidate->name, key_name, sizeof(candidate->name)) != 0) {
+                continue;
+            }
+            /* a key decrypts the tickets it issued for one more lifetime after it stopped issuing them */
+            if (now < candidate->not_before + 2 * resumption->ticket_lifetime) {
+                key = *candidate;
+                /* ask the client to renew tickets issued with an older key */
+                retval = (i == resumption->tickets.current) ? 1 : 2;
+            }
+            break;
+        }
+        (void)enif_rwlock_runlock(resumption->tickets.lock);
+        if (retval != 0) {
+            if (!HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key), EVP_sha256(), NULL) ||
+                !EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.cipher_key, iv)) {
+                retval = -1;
+            } else {
+                (void)SSL_set_ex_data(ssl, ssl_ticket_ex_index, (void *)resumption);
+            }
+        }
+    }
+
+    (void)OPENSSL_cleanse(&key, sizeof(key));
+    return retval;
+}
+
+static uint64_t
+hash_name(const char *name, size_t len)
+{
+    /* FNV-1a */
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i != len; ++i) {
+        hash ^= (unsigned char)name[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static h2o_nif_ssl_cert_t **
+find_cert(h2o_nif_ssl_store_t *store, const char *name, size_t len)
+{
+    h2o_nif_ssl_cert_t **slot = &store->buckets[hash_name(name, len) & (store->num_buckets - 1)];
+    while (*slot != NULL && !h2o_memis((*slot)->name.base, (*slot)->name.len, name, len)) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+static void
+free_cert(h2o_nif_ssl_cert_t *cert)
+{
+    if (cert->ctx != NULL) {
+        (void)SSL_CTX_free(cert->ctx);
+    }
+    (void)OPENSSL_cleanse(cert->key.base, cert->key.len);
+    (void)enif_free(cert);
+}
+
+static int
+grow_buckets(h2o_nif_ssl_store_t *store)
+{
+    size_t num_buckets = store->num_buckets * 2;
+    h2o_nif_ssl_cert_t **buckets = enif_alloc(sizeof(buckets[0]) * num_buckets);
+    size_t i;
+    if (buckets == NULL) {
+        /* longer chains, still correct */
+        return 0;
+    }
+    (void)memset(buckets, 0, sizeof(buckets[0]) * num_buckets);
+    for (i = 0; i != store->num_buckets; ++i) {
+        h2o_nif_ssl_cert_t *cert = store->buckets[i];
+        while (cert != NULL) {
+            h2o_nif_ssl_cert_t *next = cert->next;
+            h2o_nif_ssl_cert_t **slot = &buckets[hash_name(cert->name.base, cert->name.len) & (num_buckets - 1)];
+            cert->next = *slot;
+            *slot = cert;
+            cert = next;
+        }
+    }
+    (void)enif_free(store->buckets);
+    store->buckets = buckets;
+    store->num_buckets = num_buckets;
+    return 1;
+}
+
+/*
+ * Only the certificate, key, ECDH curve and protocol negotiation need to be set: the options and ciphers of a handshake are
+ * those of the listener SSL_CTX it started with, which also keeps serving the session cache and tickets.
+ */
+static SSL_CTX *
+create_store_ctx(h2o_nif_ssl_store_t *store, int is_pem, h2o_iovec_t certificate, h2o_iovec_t key)
+{
+    SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+    if (ctx == NULL) {
+        return NULL;
+    }
+    (void)SSL_CTX_set_session_id_context(ctx, (const unsigned char *)"h2o_nif", sizeof("h2o_nif") - 1);
+    (void)SSL_CTX_set_ecdh_auto(ctx, 1);
+    if (is_pem) {
+        BIO *bio = NULL;
+        X509 *x509 = NULL;
+        EVP_PKEY *pkey = NULL;
+        int ok = 0;
+        if ((bio = BIO_new_mem_buf(certificate.base, (int)certificate.len)) != NULL &&
+            (x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL)) != NULL && SSL_CTX_use_certificate(ctx, x509) == 1) {
+            X509 *ca;
+            ok = 1;
+            while ((ca = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+                if (SSL_CTX_add_extra_chain_cert(ctx, ca) != 1) {
+                    (void)X509_free(ca);
+                    ok = 0;
+                    break;
+                }
+            }
+            /* the end of the chain shows up as a PEM "no start line" error */
+            (void)ERR_clear_error();
+        }
+        if (x509 != NULL) {
+            (void)X509_free(x509);
+        }
+        if (bio != NULL) {
+            (void)BIO_free(bio);
+        }
+        bio = NULL;
+        if (ok) {
+            ok = ((bio = BIO_new_mem_buf(key.base, (int)key.len)) != NULL &&
+                  (pkey = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL)) != NULL && SSL_CTX_use_PrivateKey(ctx, pkey) == 1);
+        }
+        if (pkey != NULL) {
+            (void)EVP_PKEY_free(pkey);
+        }
+        if (bio != NULL) {
+            (void)BIO_free(bio);
+        }
+        if (!ok) {
+            goto Error;
+        }
+    } else if (SSL_CTX_use_certificate_chain_file(ctx, certificate.base) != 1 ||
+               SSL_CTX_use_PrivateKey_file(ctx, key.base, SSL_FILETYPE_PEM) != 1) {
+        goto Error;
+    }
+    if (SSL_CTX_check_private_key(ctx) != 1) {
+        goto Error;
+    }
+#if H2O_USE_NPN
+    (void)h2o_ssl_register_npn_protocols(ctx, h2o_http2_npn_protocols);
+#endif
+#if H2O_USE_ALPN
+    (void)h2o_ssl_register_alpn_protocols(ctx, h2o_http2_alpn_protocols);
+#endif
+    if (store->resumption != NULL) {
+        (void)h2o_nif_ssl_setup_session_resumption(store->resumption, &ctx, 1);
+    }
+    return ctx;
+
+Error:
+    (void)ERR_print_errors_fp(stderr);
+    (void)SSL_CTX_free(ctx);
+    return NULL;
+}
@@ -0,0 +1,99 @@
+// -*- mode: c; tab-width: 4; indent-tabs-mode: nil; st-rulers: [132] -*-
+// vim: ts=4 sw=4 ft=c et
+
+#ifndef H2O_NIF_SSL_H
+#define H2O_NIF_SSL_H
+
+#include "globals.h"
+#include <openssl/ssl.h>
+
+#define H2O_NIF_SSL_RESUMPTION_CACHE 0x1
+#define H2O_NIF_SSL_RESUMPTION_TICKET 0x2
+#define H2O_NIF_SSL_RESUMPTION_ALL (H2O_NIF_SSL_RESUMPTION_CACHE | H2O_NIF_SSL_RESUMPTION_TICKET)
+
+/*
+ * Ticket keys encrypt new tickets for `ticket_lifetime` seconds and are kept around to decrypt them for another
+ * `ticket_lifetime`, so the ring only ever needs the current key, the previous one and a spare slot.
+ */
+#define H2O_NIF_SSL_NUM_TICKET_KEYS 3
+
+typedef struct h2o_nif_ssl_stats_s h2o_nif_ssl_stats_t;
+typedef struct h2o_nif_ssl_ticket_key_s h2o_nif_ssl_ticket_key_t;
+typedef struct h2o_nif_ssl_resumption_s h2o_nif_ssl_resumption_t;
+typedef struct h2o_nif_ssl_cert_s h2o_nif_ssl_cert_t;
+typedef struct h2o_nif_ssl_store_s h2o_nif_ssl_store_t;
+
+struct h2o_nif_ssl_stats_s {
+    _Atomic uint64_t full_handshakes;    /* handshakes that negotiated a new session */
+    _Atomic uint64_t resumptions;        /* handshakes that resumed a session from the cache or a ticket */
+    _Atomic uint64_t ticket_resumptions; /* resumptions of a session carried by a ticket */
+};
+
+struct h2o_nif_ssl_ticket_key_s {
+    unsigned char name[16];
+    unsigned char cipher_key[32];
+    unsigned char hmac_key[32];
+    uint64_t not_before;
+};
+
+struct h2o_nif_ssl_resumption_s {
+    int mode;
+    size_t cache_capacity;
+    uint64_t cache_lifetime;
+    uint64_t ticket_lifetime;
+    struct {
+        ErlNifRWLock *lock;
+        size_t current; /* index of the newest key, valid once `num_keys != 0` */
+        size_t num_keys;
+        h2o_nif_ssl_ticket_key_t entries[H2O_NIF_SSL_NUM_TICKET_KEYS];
+    } tickets;
+};
+
+/*
+ * Certificates keyed by SNI server name.  Entries only record where the certificate and key come from (files or PEM pushed
+ * from Erlang); the SSL_CTX is built on the first handshake asking for the name and the least recently used ones are freed
+ * once more than `capacity` are loaded.  A name starting with "*." matches exactly one more label.
+ */
+struct h2o_nif_ssl_cert_s {
+    h2o_nif_ssl_cert_t *next; /* bucket chain */
+    h2o_linklist_t _lru;      /* linked while `ctx != NULL` */
+    uint64_t version;         /* tells a replaced entry apart from its successor while loading outside of the lock */
+    h2o_iovec_t name;         /* lowercase */
+    int is_pem;               /* `certificate` and `key` hold PEM data rather than file names */
+    int load_failed;          /* don't retry a broken certificate on every handshake, `put` resets it */
+    h2o_iovec_t certificate;
+    h2o_iovec_t key;
+    SSL_CTX *ctx;
+};
+
+struct h2o_nif_ssl_store_s {
+    ErlNifMutex *lock;
+    h2o_nif_ssl_resumption_t *resumption;
+    size_t capacity; /* maximum number of loaded SSL_CTXs */
+    h2o_nif_ssl_cert_t **buckets;
+    size_t num_buckets; /* power of two */
+    _Atomic size_t num_certs;
+    size_t num_loaded;
+    uint64_t next_version;
+    h2o_linklist_t lru; /* least recently used first */
+};
+
+/* Resumption Functions */
+
+extern int h2o_nif_ssl_resumption_init(h2o_nif_ssl_resumption_t *resumption);
+extern void h2o_nif_ssl_resumption_dispose(h2o_nif_ssl_resumption_t *resumption);
+extern int h2o_nif_ssl_setup_session_resumption(h2o_nif_ssl_resumption_t *resumption, SSL_CTX **contexts, size_t num_contexts);
+
+/* Store Functions */
+
+extern int h2o_nif_ssl_store_init(h2o_nif_ssl_store_t *store, h2o_nif_ssl_resumption_t *resumption);
+extern void h2o_nif_ssl_store_dispose(h2o_nif_ssl_store_t *store);
+extern int h2o_nif_ssl_store_put(h2o_nif_ssl_store_t *store, h2o_iovec_t name, int is_pem, h2o_iovec_t certificate,
+                                 h2o_iovec_t key);
+extern int h2o_nif_ssl_store_select(h2o_nif_ssl_store_t *store, SSL *ssl, const char *server_name);
+
+/* Stats Functions */
+
+extern void h2o_nif_ssl_set_thread_stats(h2o_nif_ssl_stats_t *stats);
+
+#endif
@@ -62,13 +62,20 @@ flush_handler(Port, Status, Headers, N, Body) ->
 			% ok = h2o_nif:handler_event_reply_multi(h2o_nif:handler_read(Port), Status, Headers, Body),
 			% flush_handler(Port, Status, Headers, Body)
 			% ok = flush_out(),
-			flush_handler(h2o_nif:handler_read(Port), Port, Status, Headers, Body, N, [])
+			flush_handler(h2o_nif:handler_read(Port), Port, Status, Headers, Body, N, []);
 			% _ = spawn(fun() ->
 				% flush_handler(h2o_nif:handler_read(Port), Port, Status, Headers, Body)
 			% end),
 			% flush_handler(Port, Status, Headers, Body)
 		% ready_input ->
 			% flush_handler(h2o_nif:handler_read(Port), Port, Status, Headers, Body)
+		{h2o_ports_data, Ports, ready_input} ->
+			case lists:member(Port, Ports) of
+				true ->
+					flush_handler(h2o_nif:handler_read(Port), Port, Status, Headers, Body, N, []);
+				false ->
+					flush_handler(Port, Status, Headers, N, Body)
+			end
 	end.
 
 % %% @private
@@ -54,20 +54,12 @@ init(Parent, Port, Path, Opts) ->
 %%%-------------------------------------------------------------------
 
 %% @private
-loop(State=#state{port=Port}) ->
+loop(State) ->
 	receive
-		{h2o_port_data, Port, ready_input} ->
-			dispatch(h2o_nif:filter_read(Port), State);
-		{h2o_port_data, EventPort, ready_input} ->
-			% io:format("ready_input~n"),
-			case get(EventPort) of
-				undefined ->
-					loop(State);
-				{Filter, FilterState0} ->
-					{ok, FilterState1} = Filter:on_ready_input(FilterState0),
-					_ = put(EventPort, {Filter, FilterState1}),
-					loop(State)
-			end;
+		{h2o_port_data, P, ready_input} ->
+			loop(ready_input(P, State));
+		{h2o_ports_data, Ports, ready_input} ->
+			loop(lists:foldl(fun ready_input/2, State, Ports));
 		{h2o_port_data, EventPort, final_input} ->
 			% io:format("final_input~n"),
 			case erase(EventPort) of
@@ -113,4 +105,18 @@ dispatch([Event=#h2o_req{event=EventPort} | Events], State=#state{opts={Filter,
 	undefined = put(EventPort, {Filter, FilterState}),
 	dispatch(Events, State);
 dispatch([], State) ->
-	loop(State).
+	State.
+
+%% @private
+ready_input(Port, State=#state{port=Port}) ->
+	dispatch(h2o_nif:filter_read(Port), State);
+ready_input(EventPort, State) ->
+	% io:format("ready_input~n"),
+	case get(EventPort) of
+		undefined ->
+			State;
+		{Filter, FilterState0} ->
+			{ok, FilterState1} = Filter:on_ready_input(FilterState0),
+			_ = put(EventPort, {Filter, FilterState1}),
+			State
+	end.
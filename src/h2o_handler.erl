@@ -61,7 +61,14 @@ init(Parent, Port, Path, Opts) ->
 loop(State=#state{port=Port}) ->
 	receive
 		{h2o_port_data, Port, ready_input} ->
-			dispatch(h2o_nif:handler_read(Port), State)
+			dispatch(h2o_nif:handler_read(Port), State);
+		{h2o_ports_data, Ports, ready_input} ->
+			case lists:member(Port, Ports) of
+				true ->
+					dispatch(h2o_nif:handler_read(Port), State);
+				false ->
+					loop(State)
+			end
 	end.
 
 pretty_print(Record) ->
@@ -51,10 +51,10 @@
 -export([port_info/1]).
 -export([port_info/2]).
 -export([port_is_alive/1]).
+-export([port_stats/0]).
 -export([port_getopt/2]).
 -export([port_setopt/3]).
 -export([port_accept/1]).
--export([port_gc/0]).
 
 %% h2o_nif/request.c.h
 -export([request_add_header/3]).
@@ -67,6 +67,9 @@
 %% h2o_nif/server.c.h
 -export([server_open/0]).
 -export([server_getcfg/1]).
+-export([server_getstats/1]).
+-export([server_put_certificate/4]).
+-export([server_set_threads/2]).
 -export([server_setcfg/2]).
 -export([server_start/1]).
 
@@ -208,6 +211,9 @@ port_info(_Port, _Item) ->
 port_is_alive(_Port) ->
 	erlang:nif_error({nif_not_loaded, ?MODULE}).
 
+port_stats() ->
+	erlang:nif_error({nif_not_loaded, ?MODULE}).
+
 port_getopt(_Port, _Opt) ->
 	erlang:nif_error({nif_not_loaded, ?MODULE}).
 
@@ -217,9 +223,6 @@ port_setopt(_Port, _Opt, _Val) ->
 port_accept(_Port) ->
 	erlang:nif_error({nif_not_loaded, ?MODULE}).
 
-port_gc() ->
-	erlang:nif_error({nif_not_loaded, ?MODULE}).
-
 %%%===================================================================
 %%% h2o_nif/request.c.h
 %%%===================================================================
@@ -252,6 +255,15 @@ server_open() ->
 server_getcfg(_Server) ->
 	erlang:nif_error({nif_not_loaded, ?MODULE}).
 
+server_getstats(_Server) ->
+	erlang:nif_error({nif_not_loaded, ?MODULE}).
+
+server_put_certificate(_Server, _Hostname, _Certificate, _Key) ->
+	erlang:nif_error({nif_not_loaded, ?MODULE}).
+
+server_set_threads(_Server, _NumThreads) ->
+	erlang:nif_error({nif_not_loaded, ?MODULE}).
+
 server_setcfg(_Server, _Config) ->
 	erlang:nif_error({nif_not_loaded, ?MODULE}).
 
@@ -34,12 +34,10 @@
 
 open() ->
 	Port = #h2o_port{} = h2o_nif:port_open(),
-	true = h2o_kernel:port_connect(Port),
 	{ok, Port}.
 
 open(Parent) ->
 	Child = #h2o_port{} = h2o_nif:port_open(Parent),
-	true = h2o_kernel:port_connect(Child),
 	{ok, Child}.
 
 close(Port) ->
@@ -126,12 +124,10 @@ controlling_process(Port, NewOwner, _) ->
 accept(LPort) ->
 	case h2o_nif:port_accept(LPort) of
 		{ok, APort} ->
-			true = h2o_kernel:port_connect(APort),
 			{ok, APort};
 		{accept, AsyncID} ->
 			receive
 				{accept, AsyncID, APort} ->
-					true = h2o_kernel:port_connect(APort),
 					{ok, APort}
 			end;
 		AcceptError ->
@@ -146,7 +142,6 @@ accept(LPort, Timeout) when is_integer(Timeout) andalso Timeout >= 0 ->
 	{Pid, MonitorRef} = spawn_monitor(fun() ->
 		case h2o_nif:port_accept(LPort) of
 			{ok, APort} ->
-				true = h2o_kernel:port_connect(APort),
 				ok = controlling_process(APort, Parent),
 				Parent ! {shoot, Ref, APort},
 				receive
@@ -156,7 +151,6 @@ accept(LPort, Timeout) when is_integer(Timeout) andalso Timeout >= 0 ->
 			{accept, AsyncID} ->
 				receive
 					{accept, AsyncID, APort} ->
-						true = h2o_kernel:port_connect(APort),
 						Parent ! {shoot, Ref, APort},
 						ok = controlling_process(APort, Parent),
 						receive
@@ -20,6 +20,9 @@
 % % -export([controlling_process/2]).
 % % -export([to_id/1]).
 -export([getcfg/1]).
+-export([getstats/1]).
+-export([put_certificate/4]).
+-export([set_threads/2]).
 -export([setcfg/2]).
 -export([start/1]).
 
@@ -37,7 +40,6 @@
 
 open() ->
 	Port = h2o_nif:server_open(),
-	true = h2o_kernel:port_connect(Port),
 	{ok, Port}.
 
 % open(Config) ->
@@ -65,6 +67,29 @@ open() ->
 getcfg(Port) ->
 	h2o_nif:server_getcfg(Port).
 
+%% Returns [{ThreadIdx, [{ipc, _}, {ssl, _}, {loop, Loop}]}] where Loop
+%% holds the pass, ipc_drain and accept histograms (microseconds) and
+%% the passes slower than `loop-watchdog-usec' with their slowest
+%% IPC callback, given as an offset into h2o_nif.so.
+%% Except for accept, these describe the loop thread, shared with the
+%% other servers of the same `loop-pool'.
+getstats(Port) ->
+	h2o_nif:server_getstats(Port).
+
+%% Certificate and Key are either PEM iodata or {file, Path}; the
+%% certificate is loaded on the first handshake for Hostname, which
+%% may be a wildcard such as <<"*.example.com">>.
+put_certificate(Port, Hostname, Certificate, Key) ->
+	h2o_nif:server_put_certificate(Port, Hostname, Certificate, Key).
+
+%% Resizes the event loop threads of a running server to NumThreads
+%% (1..1024).  Added threads take new connections right away; retired
+%% threads stop accepting and go away once their connections closed.
+%% Returns {error, busy} until the previous resize settled and
+%% {error, loop_pool} for a server on a shared `loop-pool'.
+set_threads(Port, NumThreads) ->
+	h2o_nif:server_set_threads(Port, NumThreads).
+
 setcfg(Port, Config0) ->
 	{Config1, Bindings0} = h2o_config:encode(Config0),
 	io:format("config:~n~s~n", [Config1]),